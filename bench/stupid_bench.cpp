@@ -0,0 +1,575 @@
+#include <stupid/stupid.hpp>
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <thread>
+#include <vector>
+
+//
+// Every benchmark reports the p50, p99 and p99.9 latency of a single
+// operation (in nanoseconds) alongside Google Benchmark's usual mean.
+//
+// Operations which are much cheaper than a clock read are timed in
+// batches and divided, so the percentiles are per batch rather than
+// per operation, but still show the tails.
+//
+
+namespace {
+
+using clock_t_ = std::chrono::steady_clock;
+
+class latencies
+{
+public:
+
+	latencies(size_t batch = 1) : batch_{batch} { samples_.reserve(1 << 20); }
+
+	auto batch() const { return batch_; }
+
+	auto add(clock_t_::duration d) -> void
+	{
+		if (samples_.size() < samples_.capacity())
+		{
+			samples_.push_back(double(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()) / double(batch_));
+		}
+	}
+
+	auto report(benchmark::State& state) -> void
+	{
+		if (samples_.empty()) return;
+
+		std::sort(samples_.begin(), samples_.end());
+
+		const auto flags{state.threads() > 1 ? benchmark::Counter::kAvgThreads : benchmark::Counter::kDefaults};
+
+		state.counters["p50_ns"] = benchmark::Counter(percentile(0.5), flags);
+		state.counters["p99_ns"] = benchmark::Counter(percentile(0.99), flags);
+		state.counters["p99.9_ns"] = benchmark::Counter(percentile(0.999), flags);
+	}
+
+private:
+
+	auto percentile(double p) const -> double
+	{
+		return samples_[std::min(samples_.size() - 1, size_t(p * double(samples_.size())))];
+	}
+
+	size_t batch_;
+	std::vector<double> samples_;
+};
+
+// Runs fn() repeatedly on its own thread until stopped
+class background
+{
+public:
+
+	template <typename Fn>
+	background(Fn fn)
+		: thread_{[this, fn]() mutable
+		{
+			while (!stop_.load(std::memory_order_relaxed)) fn();
+		}}
+	{
+	}
+
+	~background()
+	{
+		stop_ = true;
+		thread_.join();
+	}
+
+private:
+
+	std::atomic<bool> stop_{false};
+	std::thread thread_;
+};
+
+template <size_t Size>
+struct payload
+{
+	std::array<std::byte, Size> bytes{};
+};
+
+template <size_t Size>
+struct isolated_payload
+{
+	std::array<std::byte, Size> bytes{};
+};
+
+} // namespace
+
+template <size_t Size>
+struct stupid::isolate_ref_count<isolated_payload<Size>> : std::true_type {};
+
+namespace {
+
+constexpr size_t BATCH{16};
+
+/////////////////////////////////////////////////////////////////////////
+/// read ////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+// Shared between the threads of a multithreaded benchmark. Thread 0
+// sets it up and tears it down, and Google Benchmark keeps the other
+// threads out of the timed loop until thread 0 gets there.
+template <typename T, typename Policy>
+struct shared_object
+{
+	static inline stupid::object<T, Policy>* object{};
+	static inline background* writer{};
+
+	static auto setup(benchmark::State& state, bool with_writer) -> void
+	{
+		if (state.thread_index() != 0) return;
+
+		object = new stupid::object<T, Policy>{};
+
+		if (with_writer)
+		{
+			writer = new background{[]
+			{
+				object->write.set(T{});
+				std::this_thread::sleep_for(std::chrono::microseconds(10));
+			}};
+		}
+	}
+
+	static auto teardown(benchmark::State& state) -> void
+	{
+		if (state.thread_index() != 0) return;
+
+		delete writer;
+		delete object;
+
+		writer = {};
+		object = {};
+	}
+};
+
+template <typename T, typename Policy>
+void BM_acquire(benchmark::State& state)
+{
+	using shared = shared_object<T, Policy>;
+
+	shared::setup(state, state.range(0) != 0);
+
+	latencies out{BATCH};
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		for (size_t i = 0; i < BATCH; i++)
+		{
+			auto ref{shared::object->read.acquire()};
+			benchmark::DoNotOptimize(ref);
+		}
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations() * BATCH);
+	out.report(state);
+	shared::teardown(state);
+}
+
+template <typename T, typename Policy>
+void BM_borrow(benchmark::State& state)
+{
+	using shared = shared_object<T, Policy>;
+
+	shared::setup(state, state.range(0) != 0);
+
+	latencies out{BATCH};
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		for (size_t i = 0; i < BATCH; i++)
+		{
+			const auto borrow{shared::object->read.borrow()};
+			benchmark::DoNotOptimize(&borrow.get_value());
+		}
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations() * BATCH);
+	out.report(state);
+	shared::teardown(state);
+}
+
+template <typename T, typename Policy>
+void BM_get_value(benchmark::State& state)
+{
+	using shared = shared_object<T, Policy>;
+
+	shared::setup(state, state.range(0) != 0);
+
+	latencies out{BATCH};
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		for (size_t i = 0; i < BATCH; i++)
+		{
+			auto value{shared::object->read.get_value()};
+			benchmark::DoNotOptimize(value);
+		}
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations() * BATCH);
+	out.report(state);
+	shared::teardown(state);
+}
+
+// Every thread acquires the current version, reads the whole value
+// through the ref and releases it again, so each thread's reads share
+// the value's cache line with the other threads' reference count
+// updates, unless the count has been isolated
+template <typename T, typename Policy>
+void BM_acquire_and_read(benchmark::State& state)
+{
+	using shared = shared_object<T, Policy>;
+
+	shared::setup(state, state.range(0) != 0);
+
+	latencies out{BATCH};
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		for (size_t i = 0; i < BATCH; i++)
+		{
+			const auto ref{shared::object->read.acquire()};
+			unsigned sum{0};
+
+			for (const auto byte : ref->bytes) sum += unsigned(byte);
+
+			benchmark::DoNotOptimize(sum);
+		}
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations() * BATCH);
+	out.report(state);
+	shared::teardown(state);
+}
+
+// Arg is 1 if a writer thread is publishing in the background.
+//
+// policy::refcount only gets the quiet case. With a writer churning
+// in the background its readers can hit the use-after-free window
+// documented on policy::refcount, which is the whole reason the other
+// policies exist.
+#define STUPID_READ_BENCH(fn, ...) \
+	BENCHMARK_TEMPLATE(fn, __VA_ARGS__)->ArgName("writer")->Arg(0)->Arg(1)->ThreadRange(1, 8)->UseRealTime()
+
+#define STUPID_READ_BENCH_QUIET(fn, ...) \
+	BENCHMARK_TEMPLATE(fn, __VA_ARGS__)->ArgName("writer")->Arg(0)->ThreadRange(1, 8)->UseRealTime()
+
+STUPID_READ_BENCH_QUIET(BM_acquire, payload<64>, stupid::policy::refcount);
+STUPID_READ_BENCH_QUIET(BM_acquire, isolated_payload<64>, stupid::policy::refcount);
+STUPID_READ_BENCH(BM_acquire, payload<64>, stupid::policy::epoch<>);
+STUPID_READ_BENCH(BM_borrow, payload<64>, stupid::policy::epoch<>);
+STUPID_READ_BENCH_QUIET(BM_get_value, payload<64>, stupid::policy::refcount);
+STUPID_READ_BENCH(BM_get_value, payload<64>, stupid::policy::seqlock);
+
+// A value small enough to share a cache line with its reference count,
+// with and without isolate_ref_count
+STUPID_READ_BENCH_QUIET(BM_acquire_and_read, payload<32>, stupid::policy::refcount);
+STUPID_READ_BENCH_QUIET(BM_acquire_and_read, isolated_payload<32>, stupid::policy::refcount);
+STUPID_READ_BENCH(BM_acquire_and_read, payload<32>, stupid::policy::epoch<>);
+STUPID_READ_BENCH(BM_acquire_and_read, isolated_payload<32>, stupid::policy::epoch<>);
+
+// Acquire every element of a 1024 element array, either as separate
+// objects or in one batch from an object_array
+constexpr size_t ARRAY_SIZE{1024};
+
+template <typename Policy>
+void BM_acquire_separate_objects(benchmark::State& state)
+{
+	std::vector<stupid::object<payload<64>, Policy>> objects(ARRAY_SIZE);
+	std::vector<stupid::ref<payload<64>>> refs(ARRAY_SIZE);
+
+	latencies out;
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		for (size_t i = 0; i < ARRAY_SIZE; i++)
+		{
+			refs[i] = objects[i].read.acquire();
+		}
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations() * ARRAY_SIZE);
+	out.report(state);
+}
+
+template <typename Policy>
+void BM_acquire_object_array(benchmark::State& state)
+{
+	stupid::object_array<payload<64>, ARRAY_SIZE, Policy> objects;
+	std::vector<stupid::ref<payload<64>>> refs(ARRAY_SIZE);
+
+	latencies out;
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		objects.read.acquire_n(0, ARRAY_SIZE, refs.begin());
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations() * ARRAY_SIZE);
+	out.report(state);
+}
+
+BENCHMARK_TEMPLATE(BM_acquire_separate_objects, stupid::policy::epoch<>);
+BENCHMARK_TEMPLATE(BM_acquire_object_array, stupid::policy::epoch<>);
+
+/////////////////////////////////////////////////////////////////////////
+/// write ///////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+// Arg is the number of old versions kept alive by a reader, so that
+// the garbage collector always has live garbage to check
+template <typename T>
+void BM_set(benchmark::State& state)
+{
+	const auto held_count{size_t(state.range(0))};
+
+	stupid::object<T> object;
+	std::deque<stupid::ref<T>> held;
+
+	latencies out;
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		object.write.set(T{});
+
+		out.add(clock_t_::now() - begin);
+
+		if (held_count > 0)
+		{
+			state.PauseTiming();
+			held.push_back(object.read.acquire());
+			if (held.size() > held_count) held.pop_front();
+			state.ResumeTiming();
+		}
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * sizeof(T));
+	out.report(state);
+}
+
+template <typename T>
+void BM_set_pooled(benchmark::State& state)
+{
+	stupid::pool<T> pool{64};
+	stupid::object<T> object{pool};
+
+	latencies out;
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		object.write.try_set(T{});
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * sizeof(T));
+	out.report(state);
+}
+
+#define STUPID_WRITE_BENCH(size) \
+	BENCHMARK_TEMPLATE(BM_set, payload<size>)->ArgName("held")->Arg(0)->Arg(64); \
+	BENCHMARK_TEMPLATE(BM_set_pooled, payload<size>)
+
+STUPID_WRITE_BENCH(8);
+STUPID_WRITE_BENCH(64);
+STUPID_WRITE_BENCH(1024);
+STUPID_WRITE_BENCH(16384);
+
+/////////////////////////////////////////////////////////////////////////
+/// signal synced object ////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+// One simulated audio buffer: the signal is notified, then the reader
+// reads the value several times. Arg is the number of buffers between
+// writes.
+void BM_signal_synced_object_buffer(benchmark::State& state)
+{
+	constexpr size_t READS_PER_BUFFER{16};
+
+	const auto buffers_per_write{size_t(state.range(0))};
+
+	stupid::sync_signal signal;
+	stupid::signal_synced_object<payload<64>> object{signal};
+
+	latencies out;
+
+	size_t buffer{0};
+
+	for (auto _ : state)
+	{
+		if (++buffer % buffers_per_write == 0)
+		{
+			state.PauseTiming();
+			object.write.set(payload<64>{});
+			state.ResumeTiming();
+		}
+
+		const auto begin{clock_t_::now()};
+
+		signal.notify();
+
+		for (size_t i = 0; i < READS_PER_BUFFER; i++)
+		{
+			benchmark::DoNotOptimize(&object.read.get_value());
+		}
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	out.report(state);
+}
+
+BENCHMARK(BM_signal_synced_object_buffer)->ArgName("buffers_per_write")->Arg(1)->Arg(16)->Arg(1024);
+
+/////////////////////////////////////////////////////////////////////////
+/// delta object ////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+template <size_t Size>
+struct set_byte
+{
+	size_t index;
+	std::byte value;
+
+	auto apply(payload<Size>& p) const -> void { p.bytes[index] = value; }
+};
+
+// One edit and one signal tick. Compare with BM_set for the same
+// payload size.
+template <size_t Size>
+void BM_delta_push(benchmark::State& state)
+{
+	stupid::sync_signal signal;
+	stupid::delta_object<payload<Size>, set_byte<Size>> object{signal, 1024};
+
+	latencies out;
+
+	size_t i{0};
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		object.write.push(set_byte<Size>{i++ % Size, std::byte{1}});
+		signal.notify();
+		benchmark::DoNotOptimize(&object.read.get_value());
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	out.report(state);
+}
+
+BENCHMARK_TEMPLATE(BM_delta_push, 64);
+BENCHMARK_TEMPLATE(BM_delta_push, 16384);
+
+/////////////////////////////////////////////////////////////////////////
+/// ping pong ///////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+// These need two cores to mean anything
+
+void BM_trigger_round_trip(benchmark::State& state)
+{
+	stupid::trigger ping{std::memory_order_acq_rel};
+	stupid::trigger pong{std::memory_order_acq_rel};
+
+	background partner{[&]
+	{
+		if (ping) pong();
+	}};
+
+	latencies out;
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		ping();
+
+		while (!pong) {}
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	out.report(state);
+}
+
+BENCHMARK(BM_trigger_round_trip)->UseRealTime();
+
+void BM_beach_ball_ping_pong(benchmark::State& state)
+{
+	stupid::beach_ball ball{0};
+	stupid::beach_ball_player<0> a{&ball};
+	stupid::beach_ball_player<1> b{&ball};
+
+	a.ensure();
+
+	background partner{[&]
+	{
+		if (b.ensure()) b.throw_ball();
+	}};
+
+	latencies out;
+
+	for (auto _ : state)
+	{
+		const auto begin{clock_t_::now()};
+
+		a.throw_ball();
+
+		while (!a.ensure()) {}
+
+		out.add(clock_t_::now() - begin);
+	}
+
+	state.SetItemsProcessed(state.iterations());
+	out.report(state);
+}
+
+BENCHMARK(BM_beach_ball_ping_pong)->UseRealTime();
+
+} // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,5 @@
+include(CMakeFindDependencyMacro)
+
+find_dependency(Threads)
+
+include("${CMAKE_CURRENT_LIST_DIR}/stupidTargets.cmake")
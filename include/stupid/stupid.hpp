@@ -4,432 +4,5283 @@
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <new>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <type_traits>
 #include <vector>
 
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#endif
+
+#ifndef STUPID_CACHE_LINE_SIZE
+#define STUPID_CACHE_LINE_SIZE 64
+#endif
+
+// Expanded at the points where the interleaving of threads matters
+// most, e.g. between a reader loading a version and taking a reference
+// to it. Does nothing by default. A stress test can define it to yield
+// or sleep for a random moment, to make the windows wider, or to the
+// scheduling hook of a model checker.
+#ifndef STUPID_SCHEDULE_POINT
+#define STUPID_SCHEDULE_POINT() ((void)0)
+#endif
+
+// Define STUPID_CHECKS to turn on consistency checks which cost memory
+// as well as time: every control block is marked dead when destroyed
+// (which catches refs used after their version went back to a pool),
+// and beach balls keep track of who is holding them. These are
+// asserts, so they do nothing if NDEBUG is defined.
+#if defined(STUPID_CHECKS)
+#define STUPID_CHECK_BLOCK(cb) assert ((cb)->check.alive())
+#else
+#define STUPID_CHECK_BLOCK(cb) ((void)0)
+#endif
+
 namespace stupid {
 
+namespace policy {
+
+//
+// Reclamation policies for stupid::object
+//
+
+// Readers increment the reference count of the current version
+// directly.
+//
+// There is a small window in read.acquire() between loading the
+// current version and incrementing its reference count. If the writer
+// replaces that version and garbage collects it in exactly that window
+// then the reader will be left holding a deleted control block. Use
+// policy::epoch if your writer can churn that fast.
+struct refcount {};
+
+// Readers count themselves in and out of read.acquire() (or for the
+// lifetime of a read.borrow()) in one of a fixed number of slots. Each
+// thread always uses the same slot and each slot is on its own cache
+// line, so readers on different threads don't contend with each other
+// (as long as there are no more reader threads than slots.)
+//
+// The writer doesn't reclaim anything that was retired until a grace
+// period has passed, i.e. until every reader who was counted in when
+// the version was retired has left. Grace periods are tracked per
+// batch of retired versions, not per version, and the writer never
+// waits for one to pass. It just checks again next time.
+template <size_t Slots = 16>
+struct epoch
+{
+	static_assert(Slots > 0);
+};
+
+// For small trivially copyable types. Readers copy the value out
+// under a sequence counter instead of holding a reference to a
+// version. See object<T, policy::seqlock>.
+struct seqlock {};
+
+} // policy
+
+template <typename T, typename Policy = policy::refcount> class object;
 template <typename T> class ref;
+template <typename T> class pool;
+template <typename T> class reclaimer;
+template <typename T> class resource;
+
+// Specialize this for your type to put the reference count of each
+// version on its own cache line, away from the value:
+//
+//	template <> struct stupid::isolate_ref_count<AudioData> : std::true_type {};
+//
+// Worth doing if readers acquire and release refs while other threads
+// are busy reading the value, at the cost of some padding per version.
+template <typename T>
+struct isolate_ref_count : std::false_type {};
 
 namespace detail {
 
-template <typename T>
-struct control_block
+struct ref_access;
+
+inline constexpr size_t cache_line_size{STUPID_CACHE_LINE_SIZE};
+
+// True if Args is a single argument of type Self, so that forwarding
+// constructors don't hide the copy and move constructors
+template <typename Self, typename... Args>
+inline constexpr bool is_self_v{false};
+
+template <typename Self, typename Arg>
+inline constexpr bool is_self_v<Self, Arg>{std::is_same_v<std::decay_t<Arg>, Self>};
+
+// Calls fn on the way out of the scope unless dismissed first. Used
+// to undo a half finished operation without needing exceptions to be
+// enabled.
+template <typename Fn>
+class scope_guard
 {
-	const T value;
-	std::atomic<uint32_t> ref_count{0};
+public:
+
+	explicit scope_guard(Fn fn) : fn_{std::move(fn)} {}
+
+	scope_guard(const scope_guard&) = delete;
+	auto operator=(const scope_guard&) -> scope_guard& = delete;
+
+	~scope_guard()
+	{
+		if (armed_) fn_();
+	}
+
+	auto dismiss() -> void
+	{
+		armed_ = false;
+	}
+
+private:
+
+	Fn fn_;
+	bool armed_{true};
 };
 
+// The number of threads which have asked for a thread_index() so far
+inline auto thread_count() -> std::atomic<size_t>&
+{
+	static std::atomic<size_t> count{0};
+
+	return count;
+}
+
+// Each thread gets its own small number the first time it asks for
+// one. Used to spread threads across per-reader slots.
+inline auto thread_index() -> size_t
+{
+	static thread_local const size_t index{thread_count()++};
+
+	return index;
+}
+
 } // detail
 
-template <typename T>
-class object
+#if defined(STUPID_STATS)
+
+//
+// Opt-in instrumentation. Define STUPID_STATS before including this
+// header to turn it on. Otherwise none of it exists and the hooks
+// compile to nothing.
+//
+// Counters are kept per thread, in STUPID_STATS_THREAD_SLOTS slots
+// (one per thread_index(), wrapping around if there are more threads
+// than that), each on its own cache line. Every hook is a single
+// relaxed increment of the calling thread's own counter, and any
+// thread can read them at any time, e.g. to export them to telemetry.
+//
+// To check that an audio thread never frees memory, note its
+// stats::this_thread_index() and look at that slot's blocks_freed.
+//
+#ifndef STUPID_STATS_THREAD_SLOTS
+#define STUPID_STATS_THREAD_SLOTS 64
+#endif
+
+namespace stats {
+
+struct alignas(detail::cache_line_size) thread_counters
 {
-public:
+	// Control blocks (versions, and persistent container nodes)
+	// constructed and destroyed by this thread
+	std::atomic<uint64_t> blocks_allocated{0};
+	std::atomic<uint64_t> blocks_freed{0};
 
-	using cb_t = detail::control_block<T>;
-	using me_t = object<T>;
-	using ref_t = ref<T>;
+	// beach_ball::catch_ball() calls which didn't catch the ball
+	std::atomic<uint64_t> catch_failures{0};
 
-	object(const object&) = delete;
-	auto operator=(const object&) -> object& = delete;
+	// ...of which compare_exchange_weak failed even though the
+	// state hadn't changed
+	std::atomic<uint64_t> catch_spurious_failures{0};
 
-	object(object&& rhs) noexcept = default;
-	auto operator=(object&& rhs) noexcept -> object& = default;
+	// Times a signal synced reader picked up a new version
+	std::atomic<uint64_t> signal_fetches{0};
+};
 
-	template <typename... Args>
-	object(Args... args) : critical_{args...} {}
+struct totals
+{
+	uint64_t blocks_allocated{0};
+	uint64_t blocks_freed{0};
+	uint64_t catch_failures{0};
+	uint64_t catch_spurious_failures{0};
+	uint64_t signal_fetches{0};
+
+	// Control blocks which currently exist
+	auto blocks_alive() const -> uint64_t { return blocks_allocated - blocks_freed; }
+};
+
+inline constexpr size_t thread_slots{STUPID_STATS_THREAD_SLOTS};
+
+inline auto slots() -> std::array<thread_counters, thread_slots>&
+{
+	static std::array<thread_counters, thread_slots> slots;
+
+	return slots;
+}
+
+inline auto this_thread_index() -> size_t
+{
+	return detail::thread_index() % thread_slots;
+}
+
+inline auto this_thread() -> thread_counters&
+{
+	return slots()[this_thread_index()];
+}
+
+// Calls fn(index, const thread_counters&) for every slot which a
+// thread has been assigned to
+template <typename Fn>
+auto for_each_thread(Fn&& fn) -> void
+{
+	const auto count{std::min(detail::thread_count().load(), thread_slots)};
+
+	for (size_t i = 0; i < count; i++)
+	{
+		fn(i, std::as_const(slots()[i]));
+	}
+}
+
+inline auto total() -> totals
+{
+	totals out;
+
+	for_each_thread([&out](size_t, const thread_counters& counters)
+	{
+		out.blocks_allocated += counters.blocks_allocated.load(std::memory_order_relaxed);
+		out.blocks_freed += counters.blocks_freed.load(std::memory_order_relaxed);
+		out.catch_failures += counters.catch_failures.load(std::memory_order_relaxed);
+		out.catch_spurious_failures += counters.catch_spurious_failures.load(std::memory_order_relaxed);
+		out.signal_fetches += counters.signal_fetches.load(std::memory_order_relaxed);
+	});
+
+	return out;
+}
+
+} // stats
+
+#define STUPID_STATS_ADD(counter) (::stupid::stats::this_thread().counter.fetch_add(1, std::memory_order_relaxed))
+
+#else
+
+#define STUPID_STATS_ADD(counter) ((void)0)
+
+#endif
+
+namespace detail {
+
+#if defined(STUPID_STATS)
+// Counts control blocks as they are constructed and destroyed, on
+// whichever thread that happens
+struct block_counter
+{
+	block_counter() { STUPID_STATS_ADD(blocks_allocated); }
+	block_counter(const block_counter&) { STUPID_STATS_ADD(blocks_allocated); }
+	~block_counter() { STUPID_STATS_ADD(blocks_freed); }
+};
+#endif
+
+#if defined(STUPID_CHECKS)
+// Marks a control block dead when it is destroyed
+struct block_check
+{
+	static inline constexpr uint32_t ALIVE{0x5C0FFEE5};
+
+	~block_check()
+	{
+		assert (alive());
+
+		state = 0;
+	}
+
+	auto alive() const -> bool { return state == ALIVE; }
+
+	uint32_t state{ALIVE};
+};
+#endif
+
+// Used by policy::refcount. There is nothing to wait for, so a
+// grace period passes as soon as it begins. That still means a
+// retired version is never collected by the same write that retired
+// it.
+struct null_domain
+{
+	// A reader can still be about to take a reference to a version
+	// after its grace period has passed (see policy::refcount)
+	static inline constexpr bool protects_loads{false};
+
+	auto enter() -> size_t { return 0; }
+	auto exit(size_t) -> void {}
+	auto stamp() const -> uint64_t { return begun_; }
+	auto passed(uint64_t stamp) const -> bool { return begun_ > stamp; }
+	auto poll() -> void {}
+	auto begin() -> void { begun_++; }
 
 private:
 
-	struct critical_t
+	uint64_t begun_{0};
+};
+
+// Used by policy::epoch.
+//
+// Each slot has two counters, one for each phase. Readers increment
+// the counter for the current phase on the way in and decrement the
+// same one on the way out. To start a grace period the writer flips
+// the phase, and the grace period has passed once every counter for
+// the old phase has drained to zero. Readers who arrive after the flip
+// count themselves in the new phase, so a reader who keeps coming back
+// can't hold a grace period up forever.
+//
+// enter() and exit() are called by readers.
+// Everything else is only called by the writer.
+template <size_t Slots>
+class epoch_domain
+{
+public:
+
+	// Once a version's grace period has passed, no reader can take
+	// a new reference to it
+	static inline constexpr bool protects_loads{true};
+
+	epoch_domain() = default;
+
+	// Only the grace period numbers move, since the stamps of the
+	// versions the writer retired are relative to them. Nobody can
+	// be reading while the object is moved, so a grace period in
+	// progress has already passed.
+	epoch_domain(epoch_domain&& rhs) noexcept
+		: begun_{rhs.begun_}
+		, done_{rhs.begun_}
 	{
-		template <typename... Args>
-		critical_t(Args... args) : control_block{new cb_t{T{args...}, 0}} {}
+	}
 
-		critical_t(critical_t&& rhs) noexcept
+	auto operator=(epoch_domain&& rhs) noexcept -> epoch_domain&
+	{
+		begun_ = rhs.begun_;
+		done_ = rhs.begun_;
+
+		return *this;
+	}
+
+	// Returns a token to pass to exit()
+	auto enter() -> size_t
+	{
+		const auto index{thread_index() % Slots};
+
+		auto& slot{slots_[index]};
+
+		// The increment has to be ordered before the reader loads
+		// the current version, and the writer's check has to be
+		// ordered after it stores the new one, hence seq_cst
+		// everywhere.
+		for (;;)
 		{
-			this->operator=(std::move(rhs));
+			const auto phase{phase_.load(std::memory_order_seq_cst)};
+
+			STUPID_SCHEDULE_POINT();
+
+			slot.counts[phase].fetch_add(1, std::memory_order_seq_cst);
+
+			STUPID_SCHEDULE_POINT();
+
+			// If the phase was flipped in between then the
+			// writer might already have seen this counter at
+			// zero, so go again.
+			if (phase_.load(std::memory_order_seq_cst) == phase)
+			{
+				return (index << 1) | phase;
+			}
+
+			slot.counts[phase].fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+
+	auto exit(size_t token) -> void
+	{
+		slots_[token >> 1].counts[token & 1].fetch_sub(1, std::memory_order_release);
+	}
+
+	// Versions retired now will be safe to reclaim once the grace
+	// period with this number has passed.
+	auto stamp() const -> uint64_t { return begun_; }
+
+	auto passed(uint64_t stamp) const -> bool { return done_ > stamp; }
+
+	// Check if the current grace period is over
+	auto poll() -> void
+	{
+		if (done_ == begun_) return;
+
+		const auto old_phase{1 - phase_.load(std::memory_order_relaxed)};
+
+		for (; drained_ < Slots; drained_++)
+		{
+			if (slots_[drained_].counts[old_phase].load(std::memory_order_seq_cst) > 0) return;
 		}
 
-		auto operator=(critical_t&& rhs) noexcept -> critical_t&
+		done_ = begun_;
+	}
+
+	// Start a new grace period, if there isn't one in progress
+	// already. Versions must have been unpublished before this is
+	// called.
+	auto begin() -> void
+	{
+		if (done_ != begun_) return;
+
+		phase_.store(1 - phase_.load(std::memory_order_relaxed), std::memory_order_seq_cst);
+
+		drained_ = 0;
+		begun_++;
+
+		poll();
+	}
+
+private:
+
+	struct alignas(cache_line_size) slot_t
+	{
+		std::array<std::atomic<uint32_t>, 2> counts{};
+	};
+
+	std::array<slot_t, Slots> slots_;
+	alignas(cache_line_size) std::atomic<uint32_t> phase_{0};
+	size_t drained_{0};
+	uint64_t begun_{0};
+	uint64_t done_{0};
+};
+
+template <typename Policy> struct domain;
+template <> struct domain<policy::refcount> { using type = null_domain; };
+template <size_t Slots> struct domain<policy::epoch<Slots>> { using type = epoch_domain<Slots>; };
+
+template <typename Policy>
+using domain_t = typename domain<Policy>::type;
+
+template <typename T, bool Isolated = isolate_ref_count<T>::value>
+struct control_block;
+
+// Something that control blocks can be given back to when the
+// last reference to them is dropped, instead of being deleted.
+template <typename T>
+struct cb_owner
+{
+	virtual auto dispose(control_block<T>* cb) -> void = 0;
+
+protected:
+
+	~cb_owner() = default;
+};
+
+template <typename T>
+struct control_block<T, false>
+{
+	T value;
+	std::atomic<uint32_t> ref_count{0};
+	cb_owner<T>* owner{};
+
+	// Set by the writer before the block is published, and never
+	// changed after that. Versions are numbered from 1 so that 0 can
+	// mean "haven't seen one yet".
+	uint64_t generation{1};
+
+	// Only touched by the writer, after the block is retired
+	control_block* next_retired{};
+	uint64_t retired_stamp{};
+
+#if defined(STUPID_STATS)
+	block_counter counter{};
+#endif
+
+#if defined(STUPID_CHECKS)
+	block_check check{};
+#endif
+};
+
+template <typename T>
+struct control_block<T, true>
+{
+	T value;
+	alignas(cache_line_size) std::atomic<uint32_t> ref_count{0};
+	cb_owner<T>* owner{};
+
+	// Set by the writer before the block is published, and never
+	// changed after that. Versions are numbered from 1 so that 0 can
+	// mean "haven't seen one yet".
+	uint64_t generation{1};
+
+	// Only touched by the writer, after the block is retired
+	control_block* next_retired{};
+	uint64_t retired_stamp{};
+
+#if defined(STUPID_STATS)
+	block_counter counter{};
+#endif
+
+#if defined(STUPID_CHECKS)
+	block_check check{};
+#endif
+};
+
+template <typename T>
+auto dispose(control_block<T>* cb) -> void
+{
+	if (cb->owner)
+	{
+		cb->owner->dispose(cb);
+		return;
+	}
+
+	delete cb;
+}
+
+// Releasing a reference has to be ordered after everything this
+// holder did with the value, and the last one out has to see
+// everything every other holder did before it deletes it.
+template <typename T>
+auto release(control_block<T>* cb) -> void
+{
+	STUPID_CHECK_BLOCK(cb);
+
+	const auto old_count{cb->ref_count.fetch_sub(1, std::memory_order_acq_rel)};
+
+	assert (old_count > 0);
+
+	if (old_count == 1)
+	{
+		dispose(cb);
+	}
+}
+
+// Intrusive FIFO of retired control blocks, linked through
+// next_retired. Pushing and popping never allocates. Each block
+// in the list holds one reference to itself on the list's behalf.
+template <typename T>
+struct retired_list
+{
+	using cb_t = control_block<T>;
+
+	auto empty() const { return !head; }
+
+	auto push_back(cb_t* cb) -> void
+	{
+		cb->next_retired = nullptr;
+
+		if (tail) tail->next_retired = cb;
+		else      head = cb;
+
+		tail = cb;
+		size++;
+	}
+
+	auto pop_front() -> cb_t*
+	{
+		const auto cb{head};
+
+		assert (cb);
+
+		head = cb->next_retired;
+
+		if (!head) tail = nullptr;
+
+		size--;
+
+		return cb;
+	}
+
+	auto release_all() -> void
+	{
+		while (head) release(pop_front());
+	}
+
+	cb_t* head{};
+	cb_t* tail{};
+	size_t size{0};
+};
+
+// The writer's garbage collection sweep. Blocks are retired onto
+// waiting, move to held once their grace period has passed, and are
+// handed to reclaim(cb) once nobody else holds them.
+//
+// Checks up to budget held blocks. Blocks which are still referenced
+// go to the back of the line to be checked again later. Returns the
+// number of blocks which are still waiting to be reclaimed.
+template <typename T, typename Domain, typename ReclaimFn>
+auto collect(Domain& domain, retired_list<T>& waiting, retired_list<T>& held, size_t budget, ReclaimFn&& reclaim) -> size_t
+{
+	domain.poll();
+
+	// Versions are retired in order, so once we find one whose
+	// grace period hasn't passed yet, none of the ones after it
+	// have either
+	while (!waiting.empty() && domain.passed(waiting.head->retired_stamp))
+	{
+		held.push_back(waiting.pop_front());
+	}
+
+	for (auto checks = std::min(budget, held.size); checks > 0; checks--)
+	{
+		const auto cb{held.pop_front()};
+
+		assert (cb->ref_count.load(std::memory_order_relaxed) > 0);
+
+		STUPID_SCHEDULE_POINT();
+
+		// Acquire, so that everything the other holders did with
+		// the value happens before we delete it
+		if (cb->ref_count.load(std::memory_order_acquire) != 1)
 		{
-			control_block.store(rhs.control_block.load());
-			rhs.control_block.store(nullptr);
+			held.push_back(cb);
+			continue;
+		}
 
-			return *this;
+		// If nobody can take a new reference then ours really is
+		// the last one, and there's no need for the decrement.
+		// Otherwise a reader might have got in just now.
+		if constexpr (Domain::protects_loads)
+		{
+			reclaim(cb);
+		}
+		else if (cb->ref_count.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			reclaim(cb);
 		}
+	}
 
-		std::atomic<cb_t*> control_block;
-	} critical_;
+	// If anything is still waiting for a grace period which hasn't
+	// started yet, start one
+	if (!waiting.empty())
+	{
+		domain.begin();
+	}
+
+	return waiting.size + held.size;
+}
+
+template <typename T, typename Domain>
+auto collect(Domain& domain, retired_list<T>& waiting, retired_list<T>& held, size_t budget) -> size_t
+{
+	return collect(domain, waiting, held, budget, [](control_block<T>* cb) { dispose(cb); });
+}
 
+//
+// Tells non-realtime readers about new versions, so that they don't
+// have to poll. Used by object<T>, which only allocates one the first
+// time somebody subscribes or waits, so objects nobody listens to pay
+// one pointer for all this.
+//
+// Waiters are one-shot and wake up once a version newer than the one
+// they were waiting for is published. They are intrusive, so waiting
+// doesn't allocate. Subscribers are called for every version. The
+// writer only takes the lock at all if pending() is true.
+//
+// Subscribers are called and waiters are woken after the lock is
+// released, so either may subscribe, unsubscribe or even publish a new
+// version from inside. Each subscriber node is shared between its
+// subscription and the writer's list of subscribers to call, so it
+// stays alive until the writer is done with it.
+//
+// pending() is a seq_cst load, and the writer calls it after its
+// seq_cst store of the new version. Waiters set the flag before they
+// check the current version, also seq_cst, so either the waiter sees
+// the new version or the writer sees the flag.
+//
+template <typename T>
+class notifier
+{
 public:
 
-	struct read_t
+	struct waiter_t
 	{
-		read_t(me_t* self) : self_{self} {}
-		read_t(read_t&& rhs) noexcept {}
+		waiter_t* next{};
+
+		// Wake up once a version newer than this is published
+		uint64_t after{};
+
+		// Set to the version which woke the waiter up
+		ref<T> version;
 
-		auto operator=(read_t&& rhs) noexcept -> read_t&
+		// Called from the writer thread, outside the lock. The
+		// waiter may be gone as soon as this returns.
+		void (*wake)(waiter_t*){};
+	};
+
+	struct subscriber_t
+	{
+		std::function<void(const ref<T>&)> fn;
+
+		// Null once unsubscribed, or once the notifier is gone
+		std::atomic<notifier*> owner{};
+	};
+
+	// Unsubscribes when destroyed. May outlive the notifier, but
+	// mustn't be destroyed at the same time as it.
+	class subscription
+	{
+	public:
+
+		subscription() = default;
+		subscription(const subscription&) = delete;
+		auto operator=(const subscription&) -> subscription& = delete;
+		subscription(subscription&& rhs) noexcept = default;
+
+		auto operator=(subscription&& rhs) noexcept -> subscription&
 		{
-			return *this;
+			reset();
+
+			node_ = std::move(rhs.node_);
+
+			return *this;
+		}
+
+		~subscription()
+		{
+			reset();
+		}
+
+		auto reset() -> void
+		{
+			if (!node_) return;
+
+			if (const auto owner{node_->owner.load()})
+			{
+				owner->unsubscribe(node_.get());
+			}
+
+			node_.reset();
+		}
+
+		explicit operator bool() const { return bool(node_); }
+
+	private:
+
+		subscription(std::shared_ptr<subscriber_t> node) : node_{std::move(node)} {}
+
+		std::shared_ptr<subscriber_t> node_;
+
+		friend class notifier;
+	};
+
+	notifier() = default;
+	notifier(const notifier&) = delete;
+	auto operator=(const notifier&) -> notifier& = delete;
+
+	// A coroutine still waiting here would never be resumed
+	~notifier()
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+
+		assert (!waiters_);
+
+		for (const auto& subscriber : subscribers_)
+		{
+			subscriber->owner.store(nullptr);
+		}
+	}
+
+	auto pending() const -> bool
+	{
+		return pending_.load(std::memory_order_seq_cst);
+	}
+
+	// current() returns a ref to the current version. If it is
+	// already newer than waiter->after then the waiter isn't added,
+	// waiter->version is set to it and false is returned.
+	template <typename CurrentFn>
+	auto wait(waiter_t* waiter, CurrentFn&& current) -> bool
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+
+		waiter->next = waiters_;
+		waiters_ = waiter;
+
+		pending_.store(true, std::memory_order_seq_cst);
+
+		auto version{current()};
+
+		if (version.generation() <= waiter->after) return true;
+
+		// Still at the head, because we've held the lock all along
+		waiters_ = waiter->next;
+		update_pending();
+
+		waiter->version = std::move(version);
+
+		return false;
+	}
+
+	auto subscribe(std::function<void(const ref<T>&)> fn) -> subscription
+	{
+		auto node{std::make_shared<subscriber_t>()};
+
+		node->fn = std::move(fn);
+		node->owner.store(this);
+
+		std::lock_guard<std::mutex> lock{mutex_};
+
+		subscribers_.push_back(node);
+
+		pending_.store(true, std::memory_order_seq_cst);
+
+		return subscription{std::move(node)};
+	}
+
+	// Called from the writer thread after version is published.
+	// A subscriber which is unsubscribed from another thread while
+	// this is running may still be called one last time.
+	auto notify(const ref<T>& version) -> void
+	{
+		// Reuse the last call's storage, unless a subscriber is
+		// publishing from inside this one
+		auto calls{std::move(calls_)};
+		waiter_t* ready{};
+
+		{
+			std::lock_guard<std::mutex> lock{mutex_};
+
+			calls.assign(subscribers_.begin(), subscribers_.end());
+
+			for (auto link = &waiters_; *link;)
+			{
+				const auto waiter{*link};
+
+				if (version.generation() > waiter->after)
+				{
+					*link = waiter->next;
+					waiter->next = ready;
+					ready = waiter;
+				}
+				else
+				{
+					link = &waiter->next;
+				}
+			}
+
+			update_pending();
+		}
+
+		for (const auto& subscriber : calls)
+		{
+			if (subscriber->owner.load()) subscriber->fn(version);
+		}
+
+		calls.clear();
+		calls_ = std::move(calls);
+
+		while (ready)
+		{
+			const auto waiter{ready};
+
+			ready = waiter->next;
+			waiter->version = version;
+			waiter->wake(waiter);
+		}
+	}
+
+private:
+
+	auto unsubscribe(subscriber_t* node) -> void
+	{
+		std::lock_guard<std::mutex> lock{mutex_};
+
+		node->owner.store(nullptr);
+
+		const auto pos{std::find_if(subscribers_.begin(), subscribers_.end(), [node](const auto& subscriber) { return subscriber.get() == node; })};
+
+		assert (pos != subscribers_.end());
+
+		subscribers_.erase(pos);
+		update_pending();
+	}
+
+	auto update_pending() -> void
+	{
+		pending_.store(waiters_ || !subscribers_.empty(), std::memory_order_relaxed);
+	}
+
+	std::atomic<bool> pending_{false};
+	std::mutex mutex_;
+	waiter_t* waiters_{};
+	std::vector<std::shared_ptr<subscriber_t>> subscribers_;
+
+	// Only touched by the writer
+	std::vector<std::shared_ptr<subscriber_t>> calls_;
+};
+
+} // detail
+
+/////////////////////////////////////////////////////////////////////////
+/// resource ////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+#if defined(__cpp_lib_memory_resource)
+//
+// Allocates control blocks from a std::pmr::memory_resource instead
+// of with global new and delete, so that every version of an object
+// can live in a preallocated (say, mlock'd) region.
+//
+// Pass it to an object constructor (or anything which forwards its
+// arguments to one, like signal_synced_object), or to a pool or
+// reclaimer to have them use it too.
+//
+// A block is given back to the resource by whichever thread drops the
+// last reference to it, so the memory_resource must be thread safe,
+// unless the object also has a reclaimer, in which case blocks are
+// only given back from the thread calling reclaimer.collect().
+//
+// Only the versions of an object go through the resource. The nodes of
+// the persistent containers, the member blocks of an object_group and
+// the storage of the rings are still allocated with global new.
+//
+// Both this and the memory_resource must outlive every object and ref
+// using them.
+//
+template <typename T>
+class resource : public detail::cb_owner<T>
+{
+public:
+
+	using cb_t = detail::control_block<T>;
+
+	resource(std::pmr::memory_resource& memory) : memory_{&memory} {}
+
+	resource(const resource&) = delete;
+	auto operator=(const resource&) -> resource& = delete;
+
+	auto memory() const -> std::pmr::memory_resource* { return memory_; }
+
+	template <typename... Args>
+	auto make(Args&&... args) -> cb_t*
+	{
+		const auto storage{memory_->allocate(sizeof(cb_t), alignof(cb_t))};
+
+		// Give the storage back if the constructor throws
+		detail::scope_guard guard{[this, storage] { memory_->deallocate(storage, sizeof(cb_t), alignof(cb_t)); }};
+
+		const auto cb{new (storage) cb_t{T{std::forward<Args>(args)...}, 0, this}};
+
+		guard.dismiss();
+
+		return cb;
+	}
+
+	auto dispose(cb_t* cb) -> void override
+	{
+		cb->~cb_t();
+
+		memory_->deallocate(cb, sizeof(cb_t), alignof(cb_t));
+	}
+
+private:
+
+	std::pmr::memory_resource* memory_;
+};
+#endif
+
+namespace detail {
+
+// Allocates a block from the resource if there is one, otherwise
+// with new
+template <typename T, typename... Args>
+auto new_block(resource<T>* resource, Args&&... args) -> control_block<T>*
+{
+#if defined(__cpp_lib_memory_resource)
+	if (resource) return resource->make(std::forward<Args>(args)...);
+#else
+	assert (!resource);
+#endif
+
+	return new control_block<T>{T{std::forward<Args>(args)...}, 0};
+}
+
+} // detail
+
+/////////////////////////////////////////////////////////////////////////
+/// pool ////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Fixed-capacity pool of control blocks
+//
+// All the memory is allocated up front in the constructor. After that,
+// taking a block from the pool or giving one back never allocates or
+// locks.
+//
+// Blocks can be given back from any thread (whichever thread drops
+// the last reference) and a pool can be shared between several
+// objects, even ones with different writer threads.
+//
+// The pool must outlive every object and ref using it.
+//
+template <typename T>
+class pool : public detail::cb_owner<T>
+{
+public:
+
+	using cb_t = detail::control_block<T>;
+	using resource_t = resource<T>;
+
+	pool(size_t capacity)
+		: slots_{new slot_t[capacity]}
+		, capacity_{capacity}
+	{
+		init();
+	}
+
+#if defined(__cpp_lib_memory_resource)
+	// The pool's storage is allocated from the resource, and so is
+	// any block an object has to allocate because the pool is
+	// exhausted
+	pool(size_t capacity, resource_t& resource)
+		: slots_{static_cast<slot_t*>(resource.memory()->allocate(sizeof(slot_t) * capacity, alignof(slot_t)))}
+		, capacity_{capacity}
+		, resource_{&resource}
+	{
+		std::uninitialized_default_construct_n(slots_, capacity);
+
+		init();
+	}
+#endif
+
+	pool(const pool&) = delete;
+	auto operator=(const pool&) -> pool& = delete;
+
+	~pool()
+	{
+#if defined(__cpp_lib_memory_resource)
+		if (resource_)
+		{
+			std::destroy_n(slots_, capacity_);
+			resource_->memory()->deallocate(slots_, sizeof(slot_t) * capacity_, alignof(slot_t));
+			return;
+		}
+#endif
+
+		delete[] slots_;
+	}
+
+	auto capacity() const { return capacity_; }
+	auto get_resource() const -> resource_t* { return resource_; }
+
+	// Construct a new control block in a free slot.
+	// Returns nullptr if the pool is exhausted. If T's constructor
+	// throws, the slot goes back on the free list.
+	template <typename... Args>
+	auto make(Args&&... args) -> cb_t*
+	{
+		const auto slot{pop()};
+
+		if (!slot) return nullptr;
+
+		detail::scope_guard guard{[this, slot] { push(slot); }};
+
+		const auto cb{new (slot->storage) cb_t{T{std::forward<Args>(args)...}, 0, this}};
+
+		guard.dismiss();
+
+		return cb;
+	}
+
+	// True if the block lives in one of this pool's slots, rather
+	// than having been allocated normally because the pool was
+	// exhausted
+	auto owns(const cb_t* cb) const -> bool
+	{
+		const auto bytes{reinterpret_cast<const std::byte*>(cb)};
+		const auto begin{reinterpret_cast<const std::byte*>(slots_)};
+
+		return !std::less<>{}(bytes, begin) && std::less<>{}(bytes, begin + sizeof(slot_t) * capacity_);
+	}
+
+	auto dispose(cb_t* cb) -> void override
+	{
+		assert (owns(cb));
+
+		cb->~cb_t();
+
+		push(reinterpret_cast<slot_t*>(cb));
+	}
+
+private:
+
+	static inline constexpr uint32_t NIL{ 0xFFFFFFFF };
+
+	struct slot_t
+	{
+		alignas(cb_t) std::byte storage[sizeof(cb_t)];
+		std::atomic<uint32_t> next;
+	};
+
+	// The head of the free list is tagged with a counter which is
+	// bumped on every change, so that the compare_exchange can't
+	// be fooled by a slot being popped and pushed back in between
+	// (ABA.)
+	static auto pack(uint32_t tag, uint32_t index) -> uint64_t { return (uint64_t(tag) << 32) | index; }
+	static auto tag_of(uint64_t head) -> uint32_t { return uint32_t(head >> 32); }
+	static auto index_of(uint64_t head) -> uint32_t { return uint32_t(head); }
+
+	auto init() -> void
+	{
+		assert (capacity_ > 0 && capacity_ < NIL);
+
+		for (size_t i = 0; i < capacity_; i++)
+		{
+			slots_[i].next.store(i + 1 < capacity_ ? uint32_t(i + 1) : NIL, std::memory_order_relaxed);
+		}
+
+		head_.store(pack(0, 0));
+	}
+
+	auto pop() -> slot_t*
+	{
+		auto head{head_.load(std::memory_order_acquire)};
+
+		for (;;)
+		{
+			const auto index{index_of(head)};
+
+			if (index == NIL) return nullptr;
+
+			const auto next{slots_[index].next.load(std::memory_order_relaxed)};
+
+			STUPID_SCHEDULE_POINT();
+
+			if (head_.compare_exchange_weak(head, pack(tag_of(head) + 1, next), std::memory_order_acquire, std::memory_order_acquire))
+			{
+				return &slots_[index];
+			}
+		}
+	}
+
+	auto push(slot_t* slot) -> void
+	{
+		const auto index{uint32_t(slot - slots_)};
+
+		assert (index < capacity_);
+
+		auto head{head_.load(std::memory_order_relaxed)};
+
+		do
+		{
+			slot->next.store(index_of(head), std::memory_order_relaxed);
+		}
+		while (!head_.compare_exchange_weak(head, pack(tag_of(head) + 1, index), std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	slot_t* slots_;
+	size_t capacity_;
+	resource_t* resource_{};
+	std::atomic<uint64_t> head_;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// reclaimer ///////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Normally whichever thread drops the last reference to a version
+// deletes it, and that can be a reader (if the object has already been
+// destroyed, or the version was released by the writer's garbage
+// collector.) If T has an expensive destructor, that's bad news on a
+// realtime thread.
+//
+// Objects constructed with a reclaimer hand their versions to it
+// instead. Dropping the last reference just pushes the version onto a
+// lock-free list, and it isn't destroyed until collect() is called,
+// from whichever thread you like.
+//
+// Pushing is a compare_exchange loop. collect() takes the whole list
+// with a single exchange, so there is no ABA problem.
+//
+// The reclaimer must outlive every object constructed with it and
+// every ref to their versions.
+//
+template <typename T>
+class reclaimer : public detail::cb_owner<T>
+{
+public:
+
+	using cb_t = detail::control_block<T>;
+	using pool_t = pool<T>;
+	using resource_t = resource<T>;
+
+	reclaimer() = default;
+
+	// Versions are taken from the given pool (as if the object had
+	// been constructed with it) and given back to it by collect()
+	reclaimer(pool_t& pool) : pool_{&pool}, resource_{pool.get_resource()} {}
+
+#if defined(__cpp_lib_memory_resource)
+	// Versions are allocated from the given resource and given
+	// back to it by collect()
+	reclaimer(resource_t& resource) : resource_{&resource} {}
+#endif
+
+	reclaimer(const reclaimer&) = delete;
+	auto operator=(const reclaimer&) -> reclaimer& = delete;
+
+	~reclaimer()
+	{
+		collect();
+	}
+
+	auto get_pool() const -> pool_t* { return pool_; }
+	auto get_resource() const -> resource_t* { return resource_; }
+
+	// Called from any thread, when the last reference to a version
+	// is dropped. Never frees anything.
+	auto dispose(cb_t* cb) -> void override
+	{
+		auto head{head_.load(std::memory_order_relaxed)};
+
+		do
+		{
+			cb->next_retired = head;
+
+			STUPID_SCHEDULE_POINT();
+		}
+		while (!head_.compare_exchange_weak(head, cb, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	// Destroy every version that has been handed over so far.
+	// Returns the number destroyed.
+	auto collect() -> size_t
+	{
+		auto cb{head_.exchange(nullptr, std::memory_order_acquire)};
+
+		size_t count{0};
+
+		while (cb)
+		{
+			const auto next{cb->next_retired};
+
+			if (pool_ && pool_->owns(cb)) pool_->dispose(cb);
+#if defined(__cpp_lib_memory_resource)
+			else if (resource_) resource_->dispose(cb);
+#endif
+			else delete cb;
+
+			cb = next;
+			count++;
+		}
+
+		return count;
+	}
+
+	// Only a hint unless called from the collecting thread
+	auto empty() const -> bool
+	{
+		return !head_.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	pool_t* pool_{};
+	resource_t* resource_{};
+	std::atomic<cb_t*> head_{nullptr};
+};
+
+template <typename T, typename Policy>
+class object
+{
+public:
+
+	using cb_t = detail::control_block<T>;
+	using me_t = object<T, Policy>;
+	using pool_t = pool<T>;
+	using reclaimer_t = reclaimer<T>;
+	using resource_t = resource<T>;
+	using ref_t = ref<T>;
+
+	object(const object&) = delete;
+	auto operator=(const object&) -> object& = delete;
+
+	// Nothing else may be reading or writing either object while
+	// it is being moved.
+	object(object&& rhs) noexcept
+		: critical_{std::move(rhs.critical_)}
+		, read{this}
+		, write{this, std::move(rhs.write)}
+	{
+	}
+
+	auto operator=(object&& rhs) noexcept -> object&
+	{
+		critical_ = std::move(rhs.critical_);
+		write = std::move(rhs.write);
+
+		return *this;
+	}
+
+	template <typename... Args, typename = std::enable_if_t<!detail::is_self_v<object, Args...>>>
+	object(Args&&... args) : critical_{std::forward<Args>(args)...} {}
+
+	// New versions of the object will be taken from the given
+	// pool. The pool must outlive the object.
+	template <typename... Args>
+	object(pool_t& pool, Args&&... args) : critical_{pool, std::forward<Args>(args)...} {}
+
+	// Versions of the object will be handed to the given reclaimer
+	// when the last reference to them is dropped, instead of being
+	// destroyed there and then. If the reclaimer has a pool, new
+	// versions are taken from it. The reclaimer must outlive the
+	// object and every ref to its versions.
+	template <typename... Args>
+	object(reclaimer_t& reclaimer, Args&&... args) : critical_{reclaimer, std::forward<Args>(args)...} {}
+
+#if defined(__cpp_lib_memory_resource)
+	// Versions of the object will be allocated from the given
+	// resource instead of with new. The resource must outlive the
+	// object and every ref to its versions.
+	template <typename... Args>
+	object(resource_t& resource, Args&&... args) : critical_{resource, std::forward<Args>(args)...} {}
+#endif
+
+private:
+
+	struct critical_t
+	{
+		template <typename... Args, typename = std::enable_if_t<!detail::is_self_v<critical_t, Args...>>>
+		critical_t(Args&&... args) : control_block{new cb_t{T{std::forward<Args>(args)...}, 0}} {}
+
+		// If the pool is already exhausted then the initial
+		// block is allocated normally. (The arguments are only
+		// consumed by pool_t::make() if it finds a free slot, so
+		// forwarding them twice is fine.)
+		template <typename... Args>
+		critical_t(pool_t& pool_, Args&&... args)
+			: control_block{pool_.make(std::forward<Args>(args)...)}
+			, pool{&pool_}
+			, resource{pool_.get_resource()}
+		{
+			if (!control_block.load())
+			{
+				control_block.store(detail::new_block(resource, std::forward<Args>(args)...));
+			}
+		}
+
+		template <typename... Args>
+		critical_t(reclaimer_t& reclaimer_, Args&&... args)
+			: pool{reclaimer_.get_pool()}
+			, reclaimer{&reclaimer_}
+			, resource{reclaimer_.get_resource()}
+		{
+			auto cb{pool ? pool->make(std::forward<Args>(args)...) : nullptr};
+
+			if (!cb) cb = detail::new_block(resource, std::forward<Args>(args)...);
+
+			cb->owner = reclaimer;
+			control_block.store(cb);
+		}
+
+		template <typename... Args>
+		critical_t(resource_t& resource_, Args&&... args)
+			: control_block{detail::new_block(&resource_, std::forward<Args>(args)...)}
+			, resource{&resource_}
+		{
+		}
+
+		critical_t(critical_t&& rhs) noexcept
+		{
+			this->operator=(std::move(rhs));
+		}
+
+		~critical_t()
+		{
+			delete notifier.load();
+		}
+
+		auto operator=(critical_t&& rhs) noexcept -> critical_t&
+		{
+			control_block.store(rhs.control_block.load());
+			rhs.control_block.store(nullptr);
+			pool = rhs.pool;
+			reclaimer = rhs.reclaimer;
+			resource = rhs.resource;
+			generation.store(rhs.generation.load());
+			domain = std::move(rhs.domain);
+			delete notifier.exchange(rhs.notifier.exchange(nullptr));
+
+			return *this;
+		}
+
+		// Any reader thread may get here first
+		auto get_notifier() -> detail::notifier<T>&
+		{
+			if (const auto existing{notifier.load()}) return *existing;
+
+			auto created{std::make_unique<detail::notifier<T>>()};
+			detail::notifier<T>* expected{};
+
+			if (!notifier.compare_exchange_strong(expected, created.get())) return *expected;
+
+			return *created.release();
+		}
+
+		std::atomic<cb_t*> control_block;
+
+		// Generation of the current version. Only written by the
+		// writer, after the version is published.
+		std::atomic<uint64_t> generation{1};
+
+		pool_t* pool{};
+		reclaimer_t* reclaimer{};
+		resource_t* resource{};
+		detail::domain_t<Policy> domain;
+
+		// Allocated by the first subscribe() or next(), so that
+		// objects nobody listens to don't pay for a mutex and the
+		// lists. Moved along with the rest, subscriptions included.
+		std::atomic<detail::notifier<T>*> notifier{};
+	} critical_;
+
+public:
+
+	using domain_t = detail::domain_t<Policy>;
+	using subscription_t = typename detail::notifier<T>::subscription;
+
+	struct read_t;
+
+#if defined(__cpp_lib_coroutine)
+	//
+	// Returned by read.next(). co_await it to get the first version
+	// newer than the given generation:
+	//
+	//	for (uint64_t seen{0};;)
+	//	{
+	//		const auto version{co_await object.read.next(seen)};
+	//
+	//		seen = version.generation();
+	//		...
+	//	}
+	//
+	// If there isn't one yet, the coroutine is resumed on the writer
+	// thread, from inside the write.set() which publishes it. Hop to
+	// your own executor first thing if that matters. The coroutine
+	// mustn't be destroyed while it is suspended here.
+	//
+	class next_t : private detail::notifier<T>::waiter_t
+	{
+	public:
+
+		next_t(const next_t&) = delete;
+		auto operator=(const next_t&) -> next_t& = delete;
+
+		auto await_ready() -> bool
+		{
+			this->version = self_->read.acquire();
+
+			return this->version.generation() > this->after;
+		}
+
+		auto await_suspend(std::coroutine_handle<> handle) -> bool
+		{
+			handle_ = handle;
+			this->version = {};
+			this->wake = [](typename detail::notifier<T>::waiter_t* waiter)
+			{
+				static_cast<next_t*>(waiter)->handle_.resume();
+			};
+
+			return self_->critical_.get_notifier().wait(this, [this] { return self_->read.acquire(); });
+		}
+
+		auto await_resume() -> ref_t
+		{
+			return std::move(this->version);
+		}
+
+	private:
+
+		next_t(me_t* self, uint64_t after)
+			: self_{self}
+		{
+			this->after = after;
+		}
+
+		me_t* self_;
+		std::coroutine_handle<> handle_;
+
+		friend struct read_t;
+	};
+#endif
+
+	//
+	// Scoped read-only access to a version of the object which
+	// doesn't touch its reference count. Returned by read.borrow().
+	//
+	// For as long as it is alive, the reader's epoch slot stays
+	// occupied, so the writer won't reclaim anything it retires in
+	// the meantime. Keep borrows short (one audio buffer, say) and
+	// don't hold on to one forever.
+	//
+	class borrow_t
+	{
+	public:
+
+		borrow_t(const borrow_t&) = delete;
+		auto operator=(const borrow_t&) -> borrow_t& = delete;
+		auto operator=(borrow_t&&) -> borrow_t& = delete;
+
+		borrow_t(borrow_t&& rhs) noexcept
+			: domain_{rhs.domain_}
+			, slot_{rhs.slot_}
+			, cb_{rhs.cb_}
+		{
+			rhs.domain_ = {};
+		}
+
+		~borrow_t()
+		{
+			if (!domain_) return;
+
+			domain_->exit(slot_);
+		}
+
+		auto get_value() const -> const T& { return cb_->value; }
+		auto operator*() const -> const T& { return cb_->value; }
+		auto operator->() const -> const T* { return &cb_->value; }
+		auto generation() const -> uint64_t { return cb_->generation; }
+
+	private:
+
+		borrow_t(domain_t* domain, size_t slot, cb_t* cb)
+			: domain_{domain}
+			, slot_{slot}
+			, cb_{cb}
+		{
+		}
+
+		domain_t* domain_;
+		size_t slot_;
+		cb_t* cb_;
+
+		friend struct read_t;
+	};
+
+	struct read_t
+	{
+		read_t(me_t* self) : self_{self} {}
+
+		auto acquire() const -> ref_t
+		{
+			auto& domain{self_->critical_.domain};
+
+			const auto slot{domain.enter()};
+			const auto cb{self_->critical_.control_block.load()};
+
+			assert (cb);
+
+			// With policy::refcount, this is the window described
+			// there
+			STUPID_SCHEDULE_POINT();
+
+			ref_t out{cb};
+
+			domain.exit(slot);
+
+			return out;
+		}
+
+		// Like acquire() but no reference counting happens at
+		// all. The only shared memory the reader writes to is its
+		// own epoch slot, so this costs the same no matter how
+		// many other threads are reading.
+		auto borrow() const -> borrow_t
+		{
+			static_assert(!std::is_same_v<Policy, policy::refcount>, "read.borrow() requires policy::epoch");
+
+			auto& domain{self_->critical_.domain};
+
+			const auto slot{domain.enter()};
+			const auto cb{self_->critical_.control_block.load()};
+
+			assert (cb);
+
+			return borrow_t{&domain, slot, cb};
+		}
+
+		auto get_value() const -> const T&
+		{
+			const auto cb{self_->critical_.control_block.load()};
+
+			assert (cb);
+
+			return cb->value;
+		}
+
+		// The generation of the current version. Goes up by one
+		// with every write. This is a single relaxed load, so it
+		// might lag slightly behind the version acquire() would
+		// return, but never by more than the write in progress.
+		auto generation() const -> uint64_t
+		{
+			return self_->critical_.generation.load(std::memory_order_relaxed);
+		}
+
+		// Returns an empty ref, without touching any reference
+		// count, if the current version is no newer than the given
+		// generation. Otherwise acquires it. Use ref.generation()
+		// to find out which generation you got.
+		//
+		//	if (auto thing{object.read.acquire_if_newer(seen)})
+		//	{
+		//		seen = thing.generation();
+		//		...
+		//	}
+		auto acquire_if_newer(uint64_t generation) const -> ref_t
+		{
+			if (this->generation() <= generation) return {};
+
+			return acquire();
+		}
+
+		// Call fn(ref) from the writer thread for every version
+		// published from now on, until the subscription is
+		// destroyed. fn is called from inside write.set(), after
+		// the old version has been retired and with no lock held,
+		// so it may subscribe, unsubscribe or publish. If the
+		// subscription is destroyed on another thread, fn may
+		// still be called one last time. The subscription may
+		// outlive the object. Not for realtime threads.
+		auto subscribe(std::function<void(const ref_t&)> fn) const -> subscription_t
+		{
+			return self_->critical_.get_notifier().subscribe(std::move(fn));
+		}
+
+#if defined(__cpp_lib_coroutine)
+		// co_await read.next(generation) to get the first version
+		// newer than generation. See next_t.
+		auto next(uint64_t generation) const -> next_t
+		{
+			return next_t{self_, generation};
+		}
+#endif
+
+	private:
+
+		me_t* self_;
+	} read{this};
+
+	struct write_t
+	{
+		write_t(me_t* self)
+			: self_{self}
+		{
+			instance_ = ref_t{self_->critical_.control_block.load()};
+		}
+
+		write_t(me_t* self, write_t&& rhs) noexcept
+			: self_{self}
+		{
+			this->operator=(std::move(rhs));
+		}
+
+		~write_t()
+		{
+			waiting_.release_all();
+			held_.release_all();
+			dispose_free();
+		}
+
+		auto operator=(write_t&& rhs) noexcept -> write_t&
+		{
+			waiting_.release_all();
+			held_.release_all();
+			dispose_free();
+
+			instance_ = std::move(rhs.instance_);
+			waiting_ = std::exchange(rhs.waiting_, {});
+			held_ = std::exchange(rhs.held_, {});
+			free_ = std::exchange(rhs.free_, {});
+			auto_collect_ = rhs.auto_collect_;
+
+#if defined(STUPID_STATS)
+			peak_garbage_ = rhs.peak_garbage_;
+			published_ = rhs.published_;
+#endif
+
+			return *this;
+		}
+
+		// If the object was constructed with a pool, the new
+		// version is taken from the pool. If the pool is
+		// exhausted then it is allocated normally.
+		template <typename U>
+		auto set(U&& value) -> void
+		{
+			const auto cb{make_block(std::forward<U>(value))};
+
+			publish(cb ? cb : detail::new_block(self_->critical_.resource, std::forward<U>(value)));
+		}
+
+		// Like set(), but never allocates. If there is no free
+		// slot in the pool then nothing happens, the value is
+		// left untouched, and false is returned.
+		template <typename U>
+		auto try_set(U&& value) -> bool
+		{
+			assert (self_->critical_.pool);
+
+			const auto cb{make_block(std::forward<U>(value))};
+
+			if (!cb) return false;
+
+			publish(cb);
+
+			return true;
+		}
+
+		template <typename UpdateFn>
+		auto update(UpdateFn&& fn) -> void
+		{
+			set(fn(*instance_));
+		}
+
+		template <typename UpdateFn>
+		auto try_update(UpdateFn&& fn) -> bool
+		{
+			return try_set(fn(*instance_));
+		}
+
+		// Like update(), but the new version is copied straight
+		// into its final storage from the current one, and fn
+		// modifies it there through a T&, before anyone else can
+		// see it. If fn doesn't touch most of the value then this
+		// saves a full copy compared to update():
+		//
+		//	write.update_inplace([](Thing& thing) { thing.modify(); });
+		template <typename UpdateFn>
+		auto update_inplace(UpdateFn&& fn) -> void
+		{
+			auto cb{make_block(*instance_)};
+
+			if (!cb) cb = detail::new_block(self_->critical_.resource, *instance_);
+
+			// Nobody else can see the block yet, so if fn throws
+			// it goes straight back to wherever it came from
+			detail::scope_guard guard{[this, cb] { reclaim(cb); }};
+
+			fn(cb->value);
+			guard.dismiss();
+			publish(cb);
+		}
+
+		template <typename UpdateFn>
+		auto try_update_inplace(UpdateFn&& fn) -> bool
+		{
+			assert (self_->critical_.pool);
+
+			const auto cb{make_block(*instance_)};
+
+			if (!cb) return false;
+
+			detail::scope_guard guard{[this, cb] { reclaim(cb); }};
+
+			fn(cb->value);
+			guard.dismiss();
+			publish(cb);
+
+			return true;
+		}
+
+		// Check up to budget old versions which have already been
+		// replaced, and reclaim the ones that nobody is holding
+		// anymore. Versions which are still held go to the back of
+		// the line to be checked again later.
+		//
+		// Returns the number of old versions which are still
+		// waiting to be reclaimed.
+		//
+		// Must be called from the writer thread.
+		auto collect(size_t budget = std::numeric_limits<size_t>::max()) -> size_t
+		{
+			return detail::collect(self_->critical_.domain, waiting_, held_, budget, [this](cb_t* cb) { reclaim(cb); });
+		}
+
+#if defined(STUPID_STATS)
+		struct stats_t
+		{
+			// Old versions which haven't been reclaimed yet
+			size_t garbage;
+			size_t peak_garbage;
+
+			// Versions published since the object was constructed
+			uint64_t published;
+		};
+
+		// Must be called from the writer thread
+		auto stats() const -> stats_t
+		{
+			return {waiting_.size + held_.size, peak_garbage_, published_};
+		}
+#endif
+
+		// Every set() ends with a call to collect() with this
+		// budget. The default is 4. Pass 0 to take garbage
+		// collection off the write path entirely and call
+		// collect() yourself instead.
+		auto set_auto_collect(size_t budget) -> void
+		{
+			auto_collect_ = budget;
+		}
+
+	private:
+
+		// If T is trivially copyable then nothing observable happens
+		// when a block is destroyed, so instead of giving reclaimed
+		// blocks back to wherever they came from, we keep a few and
+		// assign new values straight into them. This saves an
+		// allocation and a free per write, with or without a pool.
+		//
+		// Only for policies which protect loads. Under
+		// policy::refcount a reader who lost the race in acquire()
+		// would otherwise read a version being overwritten in
+		// place, rather than one that has merely been freed.
+		static inline constexpr bool RECYCLE{
+			std::is_trivially_copyable_v<T> &&
+			std::is_trivially_copy_assignable_v<T> &&
+			domain_t::protects_loads};
+
+		static inline constexpr size_t RECYCLE_LIMIT{8};
+
+		template <typename U>
+		auto make_block(U&& value) -> cb_t*
+		{
+			if constexpr (RECYCLE)
+			{
+				if (!free_.empty())
+				{
+					const auto cb{free_.pop_front()};
+
+					unpark(cb);
+
+					if constexpr (std::is_same_v<std::decay_t<U>, T>)
+					{
+						cb->value = value;
+					}
+					else
+					{
+						cb->value = T{std::forward<U>(value)};
+					}
+
+					return cb;
+				}
+			}
+
+			const auto pool{self_->critical_.pool};
+
+			if (!pool) return nullptr;
+
+			return pool->make(std::forward<U>(value));
+		}
+
+		// Called by collect() with blocks nobody else can see
+		auto reclaim(cb_t* cb) -> void
+		{
+			if constexpr (RECYCLE)
+			{
+				if (free_.size < RECYCLE_LIMIT)
+				{
+					cb->ref_count.store(0, std::memory_order_relaxed);
+					park(cb);
+					free_.push_back(cb);
+					return;
+				}
+			}
+
+			detail::dispose(cb);
+		}
+
+		auto dispose_free() -> void
+		{
+			while (!free_.empty())
+			{
+				const auto cb{free_.pop_front()};
+
+				unpark(cb);
+				detail::dispose(cb);
+			}
+		}
+
+		// A parked block counts as freed for STUPID_STATS, and is
+		// marked dead for STUPID_CHECKS, until it is handed out
+		// again. So a ref which outlives its version still trips
+		// the check, and blocks_alive only counts versions in use.
+		static auto park([[maybe_unused]] cb_t* cb) -> void
+		{
+			STUPID_STATS_ADD(blocks_freed);
+
+#if defined(STUPID_CHECKS)
+			STUPID_CHECK_BLOCK(cb);
+			cb->check.state = 0;
+#endif
+		}
+
+		static auto unpark([[maybe_unused]] cb_t* cb) -> void
+		{
+			STUPID_STATS_ADD(blocks_allocated);
+
+#if defined(STUPID_CHECKS)
+			assert (!cb->check.alive());
+			cb->check.state = detail::block_check::ALIVE;
+#endif
+		}
+
+		auto publish(cb_t* cb) -> void
+		{
+			// Our reference to the old control block is handed
+			// over to the garbage list, so it stays alive until
+			// it is collected.
+			const auto old_cb{std::exchange(instance_.cb_, nullptr)};
+
+			// Whoever drops the last reference to the new block
+			// should hand it to the reclaimer, if there is one
+			if (const auto reclaimer{self_->critical_.reclaimer})
+			{
+				cb->owner = reclaimer;
+			}
+
+			// Keep a reference to the new control block. This
+			// has to happen before it is published, otherwise a
+			// reader could acquire it and release it again before
+			// we get here, taking its reference count to zero.
+			instance_ = ref_t{cb};
+
+			auto& generation{self_->critical_.generation};
+
+			cb->generation = old_cb->generation + 1;
+
+			// Atomically set the new control block
+			self_->critical_.control_block = cb;
+
+			STUPID_SCHEDULE_POINT();
+
+			generation.store(cb->generation, std::memory_order_relaxed);
+
+			// Costs one load unless somebody is waiting for a new
+			// version or subscribed to them. Has to come after the
+			// seq_cst store above, see detail::notifier.
+			const auto notifier{self_->critical_.notifier.load(std::memory_order_seq_cst)};
+			const auto notify{notifier && notifier->pending()};
+
+			// Push the old control block onto the garbage. It
+			// won't be collected until a grace period has passed,
+			// so not by the collect() call below.
+			old_cb->retired_stamp = self_->critical_.domain.stamp();
+			waiting_.push_back(old_cb);
+
+#if defined(STUPID_STATS)
+			published_++;
+			peak_garbage_ = std::max(peak_garbage_, waiting_.size + held_.size);
+#endif
+
+			// Collect old control blocks that were already
+			// discarded.
+			if (auto_collect_ > 0)
+			{
+				collect(auto_collect_);
+			}
+
+			// Last, so that a subscriber which publishes from inside
+			// its callback finds everything in order. It would also
+			// replace instance_, hence the copy.
+			if (notify)
+			{
+				notifier->notify(ref_t{instance_});
+			}
+		}
+
+		me_t* self_;
+		ref_t instance_;
+
+		// Retired blocks whose grace period hasn't passed yet
+		detail::retired_list<T> waiting_;
+
+		// Retired blocks which might still be referenced
+		detail::retired_list<T> held_;
+
+		// Reclaimed blocks kept for reuse, if RECYCLE
+		detail::retired_list<T> free_;
+
+		size_t auto_collect_{4};
+
+#if defined(STUPID_STATS)
+		size_t peak_garbage_{0};
+		uint64_t published_{0};
+#endif
+	} write{this};
+};
+
+//
+// object<T, policy::seqlock>
+//
+// Instead of publishing heap allocated versions, the writer copies the
+// value into inline storage under a sequence counter, and readers copy
+// it back out, retrying if the writer was in the middle of a write.
+// There are no control blocks, no reference counts and no allocations,
+// and get_value() returns a copy of the value rather than a reference.
+//
+// Worth it for small trivially copyable types (up to a few hundred
+// bytes, say), where copying is cheaper than chasing a pointer and
+// touching a reference count. The writer never waits. A reader may
+// have to retry if it overlaps with a write.
+//
+// The write API is the same as for the other policies, so the policy
+// can be swapped per type. Writes never allocate, so the try_*
+// functions always succeed, and there is nothing to collect.
+//
+template <typename T>
+class object<T, policy::seqlock>
+{
+public:
+
+	static_assert(std::is_trivially_copyable_v<T>);
+	static_assert(std::is_default_constructible_v<T>);
+
+	using me_t = object<T, policy::seqlock>;
+
+	object(const object&) = delete;
+	auto operator=(const object&) -> object& = delete;
+
+	template <typename... Args, typename = std::enable_if_t<!detail::is_self_v<object, Args...>>>
+	object(Args&&... args)
+		: write{this, T{std::forward<Args>(args)...}}
+	{
+	}
+
+private:
+
+	static inline constexpr size_t WORDS{(sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t)};
+
+	// The value is stored as relaxed atomic words so that a reader
+	// which overlaps with a write only reads a torn copy (which it
+	// then throws away) rather than causing a data race.
+	struct alignas(detail::cache_line_size) critical_t
+	{
+		std::atomic<uint64_t> sequence{0};
+		std::array<std::atomic<uint64_t>, WORDS> words;
+	} critical_;
+
+public:
+
+	struct read_t
+	{
+		read_t(me_t* self) : self_{self} {}
+
+		auto get_value() const -> T
+		{
+			const auto& critical{self_->critical_};
+
+			std::array<uint64_t, WORDS> words;
+
+			for (;;)
+			{
+				const auto before{critical.sequence.load(std::memory_order_acquire)};
+
+				// Odd means a write is in progress
+				if (before & 1) continue;
+
+				for (size_t i = 0; i < WORDS; i++)
+				{
+					words[i] = critical.words[i].load(std::memory_order_relaxed);
+				}
+
+				STUPID_SCHEDULE_POINT();
+
+				std::atomic_thread_fence(std::memory_order_acquire);
+
+				if (critical.sequence.load(std::memory_order_relaxed) == before) break;
+			}
+
+			T out;
+
+			std::memcpy(static_cast<void*>(&out), words.data(), sizeof(T));
+
+			return out;
+		}
+
+		// Goes up by one with every write, as with the other
+		// policies. A single relaxed load.
+		auto generation() const -> uint64_t
+		{
+			return self_->critical_.sequence.load(std::memory_order_relaxed) >> 1;
+		}
+
+	private:
+
+		me_t* self_;
+	} read{this};
+
+	struct write_t
+	{
+		write_t(me_t* self, const T& value)
+			: self_{self}
+			, value_{value}
+		{
+			store();
+		}
+
+		// The writer keeps its own copy, so this doesn't go
+		// through the sequence counter
+		auto get_value() const -> const T&
+		{
+			return value_;
+		}
+
+		template <typename U>
+		auto set(U&& value) -> void
+		{
+			value_ = std::forward<U>(value);
+			store();
+		}
+
+		template <typename U>
+		auto try_set(U&& value) -> bool
+		{
+			set(std::forward<U>(value));
+
+			return true;
+		}
+
+		template <typename UpdateFn>
+		auto update(UpdateFn&& fn) -> void
+		{
+			set(fn(std::as_const(value_)));
+		}
+
+		template <typename UpdateFn>
+		auto try_update(UpdateFn&& fn) -> bool
+		{
+			update(std::forward<UpdateFn>(fn));
+
+			return true;
+		}
+
+		template <typename UpdateFn>
+		auto update_inplace(UpdateFn&& fn) -> void
+		{
+			fn(value_);
+			store();
+		}
+
+		template <typename UpdateFn>
+		auto try_update_inplace(UpdateFn&& fn) -> bool
+		{
+			update_inplace(std::forward<UpdateFn>(fn));
+
+			return true;
+		}
+
+		auto collect(size_t = std::numeric_limits<size_t>::max()) -> size_t { return 0; }
+		auto set_auto_collect(size_t) -> void {}
+
+	private:
+
+		auto store() -> void
+		{
+			auto& critical{self_->critical_};
+
+			std::array<uint64_t, WORDS> words{};
+
+			std::memcpy(words.data(), &value_, sizeof(T));
+
+			const auto sequence{critical.sequence.load(std::memory_order_relaxed)};
+
+			critical.sequence.store(sequence + 1, std::memory_order_relaxed);
+
+			// The odd sequence number has to be visible before any
+			// of the new words are
+			std::atomic_thread_fence(std::memory_order_release);
+
+			for (size_t i = 0; i < WORDS; i++)
+			{
+				critical.words[i].store(words[i], std::memory_order_relaxed);
+			}
+
+			critical.sequence.store(sequence + 2, std::memory_order_release);
+		}
+
+		me_t* self_;
+		T value_;
+	} write;
+};
+
+template <typename T>
+class ref
+{
+public:
+
+	using cb_t = detail::control_block<T>;
+
+	ref() = default;
+
+	ref(cb_t* cb)
+		: cb_{cb}
+	{
+		assert (cb);
+
+		ref_add();
+	}
+
+	ref(ref<T>&& rhs) noexcept
+	{
+		if (cb_)
+		{
+			ref_sub();
+		}
+
+		cb_ = rhs.cb_;
+		rhs.cb_ = {};
+	}
+
+	ref(const ref<T>& rhs)
+		: cb_{rhs.cb_}
+	{
+		if (!cb_) return;
+
+		assert (cb_->ref_count.load(std::memory_order_relaxed) > 0);
+
+		ref_add();
+	}
+
+	~ref()
+	{
+		if (!cb_) return;
+
+		ref_sub();
+	}
+
+	auto operator=(ref<T>&& rhs) noexcept -> ref<T>&
+	{
+		if (cb_)
+		{
+			ref_sub();
+		}
+
+		cb_ = rhs.cb_;
+		rhs.cb_ = {};
+
+		return *this;
+	}
+
+	auto operator=(const ref<T>& rhs) -> ref<T>&
+	{
+		if (cb_)
+		{
+			ref_sub();
+		}
+
+		cb_ = rhs.cb_;
+
+		if (!cb_) return *this;
+
+		assert (cb_->ref_count.load(std::memory_order_relaxed) > 0);
+
+		ref_add();
+
+		return *this;
+	}
+
+	auto get_value() const -> const T& { STUPID_CHECK_BLOCK(cb_); return cb_->value; }
+	auto operator*() const -> const T& { STUPID_CHECK_BLOCK(cb_); return cb_->value; }
+	auto operator->() const -> const T* { STUPID_CHECK_BLOCK(cb_); return &cb_->value; }
+	auto generation() const -> uint64_t { STUPID_CHECK_BLOCK(cb_); return cb_->generation; }
+
+	explicit operator bool() const { return cb_; }
+
+private:
+
+	// Taking another reference doesn't need to be ordered with
+	// anything, because whoever is doing it already has access to
+	// the control block.
+	auto ref_add() -> void
+	{
+		assert (cb_);
+		STUPID_CHECK_BLOCK(cb_);
+
+		cb_->ref_count.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	auto ref_sub() -> void
+	{
+		assert (cb_);
+
+		detail::release(cb_);
+	}
+
+	cb_t* cb_{};
+
+	template <typename, typename> friend class object;
+	friend struct detail::ref_access;
+};
+
+namespace detail {
+
+// Lets the rest of the library get at the control block behind a ref
+struct ref_access
+{
+	template <typename T>
+	static auto cb(const ref<T>& r) -> control_block<T>* { return r.cb_; }
+};
+
+template <typename T>
+auto make_ref(T&& value) -> ref<std::decay_t<T>>
+{
+	return ref<std::decay_t<T>>{new control_block<std::decay_t<T>>{std::forward<T>(value), 0}};
+}
+
+// True if r is the only reference to its node. Nobody else can be
+// looking at such a node, because the only way to reach it is through r.
+template <typename Node>
+auto is_unique(const ref<Node>& r) -> bool
+{
+	const auto cb{ref_access::cb(r)};
+
+	assert (cb);
+
+	return cb->ref_count.load(std::memory_order_acquire) == 1;
+}
+
+// Get write access to the node behind r, copying it first unless r is
+// the only reference to it
+template <typename Node>
+auto writable(ref<Node>& r) -> Node&
+{
+	if (is_unique(r))
+	{
+		return ref_access::cb(r)->value;
+	}
+
+	r = make_ref(Node{*r});
+
+	return ref_access::cb(r)->value;
+}
+
+} // detail
+
+/////////////////////////////////////////////////////////////////////////
+/// derived /////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+//
+// A value of type T plus something which is computed from it by F
+// (e.g. sorted indices or a topological order), computed lazily by
+// whichever thread asks for it first.
+//
+// Use it as the value type of an object:
+//
+//	struct sort_clips { auto operator()(const Clips& clips) const -> SortedClips; };
+//
+//	stupid::object<stupid::derived<Clips, sort_clips>> clips;
+//
+//	// In any reader
+//	const auto version{clips.read.acquire()};
+//	const auto& sorted{version->get()};
+//
+// The result lives in the same control block as the value, so it is
+// computed at most once per version, shared by every reader of that
+// version, and destroyed along with it.
+//
+// Copying a derived copies the value but not the result, so the
+// writer's new versions always start without one. F must be default
+// constructible.
+//
+template <typename T, typename F>
+class derived
+{
+public:
+
+	using value_t = T;
+	using result_t = std::decay_t<std::invoke_result_t<F, const T&>>;
+
+	template <typename... Args, typename = std::enable_if_t<!detail::is_self_v<derived, Args...>>>
+	derived(Args&&... args) : value_{std::forward<Args>(args)...} {}
+
+	derived(const derived& rhs) : value_{rhs.value_} {}
+	derived(derived&& rhs) : value_{std::move(rhs.value_)} {}
+
+	// Only for versions nobody else can see yet
+	auto operator=(const derived& rhs) -> derived&
+	{
+		value_ = rhs.value_;
+		reset();
+
+		return *this;
+	}
+
+	auto operator=(derived&& rhs) -> derived&
+	{
+		value_ = std::move(rhs.value_);
+		reset();
+
+		return *this;
+	}
+
+	auto get_value() const -> const T& { return value_; }
+	auto operator*() const -> const T& { return value_; }
+	auto operator->() const -> const T* { return &value_; }
+
+	// Only for versions nobody else can see yet, e.g. inside
+	// write.update_inplace(). Throws away the result if there is
+	// one.
+	auto modify() -> T&
+	{
+		reset();
+
+		return value_;
+	}
+
+	// Returns the result, computing it first if nobody has yet. If
+	// another thread is in the middle of computing it, waits for
+	// that thread to finish. Not for realtime threads, unless you
+	// know the result has already been computed.
+	//
+	// If F throws, the exception is passed on and the result is
+	// left uncomputed, so the next get() (or a thread which was
+	// waiting) tries again.
+	auto get() const -> const result_t&
+	{
+		for (;;)
+		{
+			auto state{state_.load(std::memory_order_acquire)};
+
+			if (state == READY) return *result_;
+
+			if (state == EMPTY && state_.compare_exchange_strong(state, COMPUTING, std::memory_order_acquire))
+			{
+				detail::scope_guard guard{[this]
+				{
+					state_.store(EMPTY, std::memory_order_relaxed);
+					notify();
+				}};
+
+				result_.emplace(F{}(value_));
+				guard.dismiss();
+				state_.store(READY, std::memory_order_release);
+				notify();
+
+				return *result_;
+			}
+
+			if (state == COMPUTING)
+			{
+#if defined(__cpp_lib_atomic_wait)
+				state_.wait(COMPUTING, std::memory_order_acquire);
+#else
+				std::this_thread::yield();
+#endif
+			}
+		}
+	}
+
+	// Returns the result if it has already been computed, otherwise
+	// nullptr. Never computes or waits, so it's fine to call from a
+	// realtime thread.
+	auto try_get() const -> const result_t*
+	{
+		if (state_.load(std::memory_order_acquire) != READY) return nullptr;
+
+		return &*result_;
+	}
+
+private:
+
+	static inline constexpr uint8_t EMPTY{0};
+	static inline constexpr uint8_t COMPUTING{1};
+	static inline constexpr uint8_t READY{2};
+
+	auto reset() -> void
+	{
+		result_.reset();
+		state_.store(EMPTY, std::memory_order_relaxed);
+	}
+
+	auto notify() const -> void
+	{
+#if defined(__cpp_lib_atomic_wait)
+		state_.notify_all();
+#endif
+	}
+
+	T value_;
+	mutable std::atomic<uint8_t> state_{EMPTY};
+	mutable std::optional<result_t> result_;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// object group ////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+template <typename U, typename... Ts> struct type_index;
+template <typename U, typename... Ts> struct type_index<U, U, Ts...> : std::integral_constant<size_t, 0> {};
+template <typename U, typename T, typename... Ts> struct type_index<U, T, Ts...> : std::integral_constant<size_t, 1 + type_index<U, Ts...>::value> {};
+
+} // detail
+
+//
+// Several objects which are always seen to change together
+//
+// Each member is versioned separately, and a version of the group is
+// just a tuple of refs to one version of each member. An edit goes
+// through a transaction which stages new versions of whichever members
+// it touches, then publishes all of them at once with a single atomic
+// swap. Members the transaction didn't touch are shared with the
+// previous version of the group, not copied.
+//
+// Readers acquire a snapshot of the whole group in one go, so they
+// can't see a mix of old and new members.
+//
+template <typename Policy, typename... Ts>
+class basic_object_group
+{
+public:
+
+	using refs_t = std::tuple<ref<Ts>...>;
+
+	template <size_t I>
+	using type_t = std::tuple_element_t<I, std::tuple<Ts...>>;
+
+	template <typename U>
+	static inline constexpr size_t index_v{ detail::type_index<U, Ts...>::value };
+
+	basic_object_group() : object_{detail::make_ref(Ts{})...} {}
+	basic_object_group(Ts... values) : object_{detail::make_ref(std::move(values))...} {}
+
+	class snapshot_t
+	{
+	public:
+
+		template <size_t I>
+		auto get() const -> const type_t<I>& { return *std::get<I>(*refs_); }
+
+		template <typename U>
+		auto get() const -> const U& { return get<index_v<U>>(); }
+
+		// A ref to just this member, which can outlive the
+		// snapshot
+		template <size_t I>
+		auto acquire() const -> ref<type_t<I>> { return std::get<I>(*refs_); }
+
+		template <typename U>
+		auto acquire() const -> ref<U> { return acquire<index_v<U>>(); }
+
+	private:
+
+		snapshot_t(ref<refs_t> refs) : refs_{std::move(refs)} {}
+
+		ref<refs_t> refs_;
+
+		friend class basic_object_group;
+	};
+
+	//
+	// Only one transaction should be in progress at a time, on
+	// the writer thread. If it is destroyed without being
+	// committed then nothing happens. A transaction can be moved
+	// but not copied, and can only be committed once.
+	//
+	class transaction_t
+	{
+	public:
+
+		transaction_t(const transaction_t&) = delete;
+		auto operator=(const transaction_t&) -> transaction_t& = delete;
+
+		transaction_t(transaction_t&& rhs) noexcept
+			: group_{std::exchange(rhs.group_, nullptr)}
+			, staged_{std::move(rhs.staged_)}
+		{
+		}
+
+		auto operator=(transaction_t&& rhs) noexcept -> transaction_t&
+		{
+			group_ = std::exchange(rhs.group_, nullptr);
+			staged_ = std::move(rhs.staged_);
+
+			return *this;
+		}
+
+		// The staged version of the member (which is the current
+		// one if this transaction hasn't touched it yet)
+		template <size_t I>
+		auto get() const -> const type_t<I>& { return *std::get<I>(staged_); }
+
+		template <size_t I, typename U>
+		auto set(U&& value) -> void
+		{
+			std::get<I>(staged_) = detail::make_ref(type_t<I>{std::forward<U>(value)});
+		}
+
+		template <size_t I, typename UpdateFn>
+		auto update(UpdateFn&& fn) -> void
+		{
+			set<I>(fn(get<I>()));
+		}
+
+		template <size_t I, typename UpdateFn>
+		auto update_inplace(UpdateFn&& fn) -> void
+		{
+			auto staged{detail::make_ref(type_t<I>{get<I>()})};
+
+			fn(detail::ref_access::cb(staged)->value);
+
+			std::get<I>(staged_) = std::move(staged);
+		}
+
+		template <typename U> auto get() const -> const U& { return get<index_v<U>>(); }
+		template <typename U, typename V> auto set(V&& value) -> void { set<index_v<U>>(std::forward<V>(value)); }
+		template <typename U, typename UpdateFn> auto update(UpdateFn&& fn) -> void { update<index_v<U>>(std::forward<UpdateFn>(fn)); }
+		template <typename U, typename UpdateFn> auto update_inplace(UpdateFn&& fn) -> void { update_inplace<index_v<U>>(std::forward<UpdateFn>(fn)); }
+
+		// Publish every staged member at once. Must not be called
+		// on a transaction which was already committed or moved
+		// from.
+		auto commit() -> void
+		{
+			assert (group_);
+
+			group_->object_.write.set(std::move(staged_));
+			group_ = nullptr;
+		}
+
+	private:
+
+		transaction_t(basic_object_group* group)
+			: group_{group}
+			, staged_{group->object_.read.get_value()}
+		{
+		}
+
+		basic_object_group* group_;
+		refs_t staged_;
+
+		friend class basic_object_group;
+	};
+
+	struct read_t
+	{
+		read_t(basic_object_group* self) : self_{self} {}
+
+		auto acquire() const -> snapshot_t
+		{
+			return snapshot_t{self_->object_.read.acquire()};
+		}
+
+	private:
+
+		basic_object_group* self_;
+	} read{this};
+
+	struct write_t
+	{
+		write_t(basic_object_group* self) : self_{self} {}
+
+		auto begin() -> transaction_t
+		{
+			return transaction_t{self_};
+		}
+
+		auto collect(size_t budget = std::numeric_limits<size_t>::max()) -> size_t
+		{
+			return self_->object_.write.collect(budget);
+		}
+
+	private:
+
+		basic_object_group* self_;
+	} write{this};
+
+private:
+
+	object<refs_t, Policy> object_;
+};
+
+template <typename... Ts>
+using object_group = basic_object_group<policy::refcount, Ts...>;
+
+/////////////////////////////////////////////////////////////////////////
+/// object array ////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+inline constexpr size_t dynamic_extent{std::numeric_limits<size_t>::max()};
+
+namespace detail {
+
+template <typename Line, size_t Lines>
+struct array_lines
+{
+	array_lines(size_t) {}
+
+	auto operator[](size_t index) -> Line& { return lines[index]; }
+	auto operator[](size_t index) const -> const Line& { return lines[index]; }
+
+	std::array<Line, Lines> lines;
+};
+
+template <typename Line>
+struct array_lines<Line, dynamic_extent>
+{
+	array_lines(size_t count) : lines{new Line[count]} {}
+
+	auto operator[](size_t index) -> Line& { return lines[index]; }
+	auto operator[](size_t index) const -> const Line& { return lines[index]; }
+
+	std::unique_ptr<Line[]> lines;
+};
+
+//
+// A lot of objects of the same type which share one writer.
+//
+// Each element is versioned separately, just like an object<T>, but the
+// atomic slots are packed together into cache line aligned storage,
+// and the whole array shares one reclamation domain, one pair of
+// retired lists, and one pool or reclaimer. An element costs two
+// words, the writer collects garbage for all of them in one sweep,
+// and readers can acquire a batch of elements in one pass.
+//
+// Use object_array<T, N> or dynamic_object_array<T>.
+//
+template <typename T, size_t N, typename Policy>
+class basic_object_array
+{
+public:
+
+	using cb_t = control_block<T>;
+	using me_t = basic_object_array<T, N, Policy>;
+	using pool_t = pool<T>;
+	using reclaimer_t = reclaimer<T>;
+	using resource_t = resource<T>;
+	using ref_t = ref<T>;
+
+	basic_object_array(const basic_object_array&) = delete;
+	auto operator=(const basic_object_array&) -> basic_object_array& = delete;
+
+	~basic_object_array()
+	{
+		for (size_t i = 0; i < size_; i++)
+		{
+			release(slot(i).control_block.load(std::memory_order_relaxed));
+		}
+	}
+
+	auto size() const { return size_; }
+
+protected:
+
+	basic_object_array(size_t size, pool_t* pool, reclaimer_t* reclaimer, resource_t* resource, const T& initial)
+		: critical_{size, pool, reclaimer, resource}
+		, size_{size}
+	{
+		for (size_t i = 0; i < size_; i++)
+		{
+			auto cb{pool ? pool->make(initial) : nullptr};
+
+			if (!cb) cb = new_block(resource, initial);
+
+			if (reclaimer) cb->owner = reclaimer;
+
+			// The array's own reference
+			cb->ref_count.store(1, std::memory_order_relaxed);
+
+			slot(i).control_block.store(cb, std::memory_order_relaxed);
+		}
+	}
+
+private:
+
+	struct slot_t
+	{
+		std::atomic<cb_t*> control_block{};
+
+		// Generation of the current version. Only written by the
+		// writer, after the version is published.
+		std::atomic<uint64_t> generation{1};
+	};
+
+	static inline constexpr size_t SLOTS_PER_LINE{std::max(size_t{1}, cache_line_size / sizeof(slot_t))};
+
+	struct alignas(cache_line_size) line_t
+	{
+		std::array<slot_t, SLOTS_PER_LINE> slots;
+	};
+
+	static constexpr auto line_count(size_t size) -> size_t
+	{
+		return (size + SLOTS_PER_LINE - 1) / SLOTS_PER_LINE;
+	}
+
+	using lines_t = array_lines<line_t, N == dynamic_extent ? dynamic_extent : line_count(N)>;
+
+	struct critical_t
+	{
+		critical_t(size_t size, pool_t* pool_, reclaimer_t* reclaimer_, resource_t* resource_)
+			: lines{line_count(size)}
+			, pool{pool_}
+			, reclaimer{reclaimer_}
+			, resource{resource_}
+		{
+		}
+
+		lines_t lines;
+		pool_t* pool;
+		reclaimer_t* reclaimer;
+		resource_t* resource;
+		domain_t<Policy> domain;
+	} critical_;
+
+	size_t size_;
+
+	auto slot(size_t index) -> slot_t&
+	{
+		assert (index < size_);
+
+		return critical_.lines[index / SLOTS_PER_LINE].slots[index % SLOTS_PER_LINE];
+	}
+
+	auto slot(size_t index) const -> const slot_t&
+	{
+		assert (index < size_);
+
+		return critical_.lines[index / SLOTS_PER_LINE].slots[index % SLOTS_PER_LINE];
+	}
+
+public:
+
+	struct read_t
+	{
+		read_t(me_t* self) : self_{self} {}
+
+		auto acquire(size_t index) const -> ref_t
+		{
+			auto& domain{self_->critical_.domain};
+
+			const auto token{domain.enter()};
+
+			ref_t out{load(index)};
+
+			domain.exit(token);
+
+			return out;
+		}
+
+		// Acquire count consecutive elements starting at first,
+		// entering the reclamation domain only once. Writes the
+		// refs to out.
+		template <typename OutputIt>
+		auto acquire_n(size_t first, size_t count, OutputIt out) const -> OutputIt
+		{
+			auto& domain{self_->critical_.domain};
+
+			const auto token{domain.enter()};
+
+			for (size_t i = 0; i < count; i++)
+			{
+				*out++ = ref_t{load(first + i)};
+			}
+
+			domain.exit(token);
+
+			return out;
+		}
+
+		// Acquire the elements at each of the given indices, in
+		// one pass. Writes the refs to out.
+		template <typename IndexIt, typename OutputIt>
+		auto acquire(IndexIt begin, IndexIt end, OutputIt out) const -> OutputIt
+		{
+			auto& domain{self_->critical_.domain};
+
+			const auto token{domain.enter()};
+
+			for (; begin != end; ++begin)
+			{
+				*out++ = ref_t{load(size_t(*begin))};
+			}
+
+			domain.exit(token);
+
+			return out;
+		}
+
+		auto get_value(size_t index) const -> const T&
+		{
+			return load(index)->value;
+		}
+
+		// Same as object<T>::read.generation(), per element
+		auto generation(size_t index) const -> uint64_t
+		{
+			return self_->slot(index).generation.load(std::memory_order_relaxed);
+		}
+
+		auto acquire_if_newer(size_t index, uint64_t generation) const -> ref_t
+		{
+			if (this->generation(index) <= generation) return {};
+
+			return acquire(index);
+		}
+
+	private:
+
+		auto load(size_t index) const -> cb_t*
+		{
+			const auto cb{self_->slot(index).control_block.load()};
+
+			assert (cb);
+
+			return cb;
+		}
+
+		me_t* self_;
+	} read{this};
+
+	struct write_t
+	{
+		write_t(me_t* self) : self_{self} {}
+
+		~write_t()
+		{
+			waiting_.release_all();
+			held_.release_all();
+		}
+
+		// If the array was constructed with a pool, the new
+		// version is taken from the pool. If the pool is
+		// exhausted then it is allocated normally.
+		template <typename U>
+		auto set(size_t index, U&& value) -> void
+		{
+			const auto cb{make_block(std::forward<U>(value))};
+
+			publish(index, cb ? cb : new_block(self_->critical_.resource, std::forward<U>(value)));
+		}
+
+		// Like set(), but never allocates. Returns false if there
+		// is no free slot in the pool.
+		template <typename U>
+		auto try_set(size_t index, U&& value) -> bool
+		{
+			assert (self_->critical_.pool);
+
+			const auto cb{make_block(std::forward<U>(value))};
+
+			if (!cb) return false;
+
+			publish(index, cb);
+
+			return true;
+		}
+
+		template <typename UpdateFn>
+		auto update(size_t index, UpdateFn&& fn) -> void
+		{
+			set(index, fn(current(index)));
+		}
+
+		template <typename UpdateFn>
+		auto update_inplace(size_t index, UpdateFn&& fn) -> void
+		{
+			auto cb{make_block(current(index))};
+
+			if (!cb) cb = new_block(self_->critical_.resource, current(index));
+
+			detail::scope_guard guard{[cb] { detail::dispose(cb); }};
+
+			fn(cb->value);
+			guard.dismiss();
+			publish(index, cb);
+		}
+
+		// Same as object<T>::write.collect(), for every element
+		// at once
+		auto collect(size_t budget = std::numeric_limits<size_t>::max()) -> size_t
+		{
+			return detail::collect(self_->critical_.domain, waiting_, held_, budget);
+		}
+
+#if defined(STUPID_STATS)
+		struct stats_t
+		{
+			size_t garbage;
+			size_t peak_garbage;
+			uint64_t published;
+		};
+
+		// Must be called from the writer thread
+		auto stats() const -> stats_t
+		{
+			return {waiting_.size + held_.size, peak_garbage_, published_};
+		}
+#endif
+
+		// Every set() ends with a call to collect() with this
+		// budget. The default is 4.
+		auto set_auto_collect(size_t budget) -> void
+		{
+			auto_collect_ = budget;
+		}
+
+	private:
+
+		auto current(size_t index) const -> const T&
+		{
+			return self_->slot(index).control_block.load(std::memory_order_relaxed)->value;
+		}
+
+		template <typename U>
+		auto make_block(U&& value) -> cb_t*
+		{
+			const auto pool{self_->critical_.pool};
+
+			if (!pool) return nullptr;
+
+			return pool->make(std::forward<U>(value));
+		}
+
+		auto publish(size_t index, cb_t* cb) -> void
+		{
+			auto& slot{self_->slot(index)};
+
+			if (const auto reclaimer{self_->critical_.reclaimer})
+			{
+				cb->owner = reclaimer;
+			}
+
+			// The array's reference to the new block. Taken before
+			// it is published, for the same reason as in
+			// object<T>. The reference to the old block is handed
+			// over to the garbage list.
+			cb->ref_count.fetch_add(1, std::memory_order_relaxed);
+
+			const auto old_cb{slot.control_block.load(std::memory_order_relaxed)};
+
+			cb->generation = old_cb->generation + 1;
+
+			slot.control_block = cb;
+			slot.generation.store(cb->generation, std::memory_order_relaxed);
+
+			old_cb->retired_stamp = self_->critical_.domain.stamp();
+			waiting_.push_back(old_cb);
+
+#if defined(STUPID_STATS)
+			published_++;
+			peak_garbage_ = std::max(peak_garbage_, waiting_.size + held_.size);
+#endif
+
+			if (auto_collect_ > 0)
+			{
+				collect(auto_collect_);
+			}
+		}
+
+		me_t* self_;
+		retired_list<T> waiting_;
+		retired_list<T> held_;
+		size_t auto_collect_{4};
+
+#if defined(STUPID_STATS)
+		size_t peak_garbage_{0};
+		uint64_t published_{0};
+#endif
+	} write{this};
+};
+
+} // detail
+
+template <typename T, size_t N, typename Policy = policy::refcount>
+class object_array : public detail::basic_object_array<T, N, Policy>
+{
+	using base_t = detail::basic_object_array<T, N, Policy>;
+
+public:
+
+	static_assert(N != dynamic_extent, "use dynamic_object_array");
+
+	object_array(const T& initial = T{}) : base_t{N, nullptr, nullptr, nullptr, initial} {}
+
+	// The pool, reclaimer or resource must outlive the array
+	object_array(pool<T>& pool, const T& initial = T{}) : base_t{N, &pool, nullptr, pool.get_resource(), initial} {}
+	object_array(reclaimer<T>& reclaimer, const T& initial = T{}) : base_t{N, reclaimer.get_pool(), &reclaimer, reclaimer.get_resource(), initial} {}
+
+#if defined(__cpp_lib_memory_resource)
+	object_array(resource<T>& resource, const T& initial = T{}) : base_t{N, nullptr, nullptr, &resource, initial} {}
+#endif
+};
+
+// Like object_array, but the size is chosen at construction
+template <typename T, typename Policy = policy::refcount>
+class dynamic_object_array : public detail::basic_object_array<T, dynamic_extent, Policy>
+{
+	using base_t = detail::basic_object_array<T, dynamic_extent, Policy>;
+
+public:
+
+	dynamic_object_array(size_t size, const T& initial = T{}) : base_t{size, nullptr, nullptr, nullptr, initial} {}
+
+	// The pool, reclaimer or resource must outlive the array
+	dynamic_object_array(size_t size, pool<T>& pool, const T& initial = T{}) : base_t{size, &pool, nullptr, pool.get_resource(), initial} {}
+	dynamic_object_array(size_t size, reclaimer<T>& reclaimer, const T& initial = T{}) : base_t{size, reclaimer.get_pool(), &reclaimer, reclaimer.get_resource(), initial} {}
+
+#if defined(__cpp_lib_memory_resource)
+	dynamic_object_array(size_t size, resource<T>& resource, const T& initial = T{}) : base_t{size, nullptr, nullptr, &resource, initial} {}
+#endif
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// replicated object ///////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+inline auto thread_node_ref() -> size_t&
+{
+	static thread_local size_t node{0};
+
+	return node;
+}
+
+} // detail
+
+// The replica of a replicated_object which the calling thread reads.
+// Defaults to 0. Call it once per reader thread, after pinning the
+// thread to a NUMA node (or to a socket, or whatever the replicas are
+// divided by.)
+inline auto set_thread_node(size_t node) -> void { detail::thread_node_ref() = node; }
+inline auto thread_node() -> size_t { return detail::thread_node_ref(); }
+
+//
+// An object with one full replica per NUMA node, for read-mostly data
+// which is read from every socket. Readers only touch the replica for
+// their own node (see set_thread_node()), so reference counts and
+// epoch slots don't bounce between sockets, and the version itself can
+// live in node-local memory.
+//
+// Each replica is an ordinary object<T, Policy> in its own cache line.
+// Every write is copied to every replica, eagerly, one after another,
+// so for a moment a reader on one node might see the new version while
+// a reader on another still sees the old one. Each replica numbers its
+// versions the same way, so generations can be compared across nodes.
+//
+// To place the versions in node-local memory, construct it with one
+// pool per node. Create each pool from a thread running on that node,
+// so that the pool's storage is first touched there. (Any memory T
+// allocates for itself is still allocated by the writer.)
+//
+template <typename T, typename Policy = policy::epoch<>>
+class replicated_object
+{
+public:
+
+	using me_t = replicated_object<T, Policy>;
+	using object_t = object<T, Policy>;
+	using pool_t = pool<T>;
+	using ref_t = ref<T>;
+
+	template <typename... Args, typename = std::enable_if_t<!detail::is_self_v<replicated_object, Args...>>>
+	replicated_object(size_t nodes, Args&&... args)
+		: critical_{nodes}
+	{
+		assert (nodes > 0);
+
+		for (size_t i = 0; i < nodes; i++)
+		{
+			critical_.replicas[i].object.emplace(args...);
+		}
+	}
+
+	// One replica per pool. The pools must outlive the object.
+	template <typename... Args>
+	replicated_object(const std::vector<pool_t*>& pools, Args&&... args)
+		: critical_{pools.size()}
+	{
+		assert (!pools.empty());
+
+		for (size_t i = 0; i < pools.size(); i++)
+		{
+			critical_.replicas[i].object.emplace(*pools[i], args...);
+		}
+	}
+
+	replicated_object(const replicated_object&) = delete;
+	auto operator=(const replicated_object&) -> replicated_object& = delete;
+
+	auto nodes() const { return critical_.nodes; }
+
+private:
+
+	struct alignas(detail::cache_line_size) replica_t
+	{
+		std::optional<object_t> object;
+	};
+
+	struct critical_t
+	{
+		critical_t(size_t nodes_)
+			: replicas{new replica_t[nodes_]}
+			, nodes{nodes_}
+		{
+		}
+
+		std::unique_ptr<replica_t[]> replicas;
+		size_t nodes;
+	} critical_;
+
+	auto replica(size_t node) -> object_t&
+	{
+		return *critical_.replicas[node % critical_.nodes].object;
+	}
+
+public:
+
+	struct read_t
+	{
+		read_t(me_t* self) : self_{self} {}
+
+		// The replica for the given node. Its read side has the
+		// same functions as this one.
+		auto replica(size_t node) const -> typename object_t::read_t&
+		{
+			return self_->replica(node).read;
+		}
+
+		// The rest of these read the calling thread's replica
+		auto local() const -> typename object_t::read_t& { return replica(thread_node()); }
+
+		auto acquire() const -> ref_t { return local().acquire(); }
+		auto get_value() const -> const T& { return local().get_value(); }
+		auto generation() const -> uint64_t { return local().generation(); }
+		auto acquire_if_newer(uint64_t generation) const -> ref_t { return local().acquire_if_newer(generation); }
+		auto borrow() const { return local().borrow(); }
+
+	private:
+
+		me_t* self_;
+	} read{this};
+
+	struct write_t
+	{
+		write_t(me_t* self) : self_{self} {}
+
+		// Copies the value into every replica
+		template <typename U>
+		auto set(U&& value) -> void
+		{
+			const T& source{value};
+
+			for (size_t i = 1; i < self_->nodes(); i++)
+			{
+				self_->replica(i).write.set(source);
+			}
+
+			self_->replica(0).write.set(std::forward<U>(value));
+		}
+
+		template <typename UpdateFn>
+		auto update(UpdateFn&& fn) -> void
+		{
+			set(fn(self_->replica(0).read.get_value()));
+		}
+
+		// fn is only called once, on the first replica, and the
+		// result is copied to the rest
+		template <typename UpdateFn>
+		auto update_inplace(UpdateFn&& fn) -> void
+		{
+			auto& first{self_->replica(0)};
+
+			first.write.update_inplace(std::forward<UpdateFn>(fn));
+
+			for (size_t i = 1; i < self_->nodes(); i++)
+			{
+				self_->replica(i).write.set(first.read.get_value());
+			}
+		}
+
+		// Collects garbage for every replica. Returns the total
+		// number of old versions still waiting.
+		auto collect(size_t budget = std::numeric_limits<size_t>::max()) -> size_t
+		{
+			size_t out{0};
+
+			for (size_t i = 0; i < self_->nodes(); i++)
+			{
+				out += self_->replica(i).write.collect(budget);
+			}
+
+			return out;
+		}
+
+		auto set_auto_collect(size_t budget) -> void
+		{
+			for (size_t i = 0; i < self_->nodes(); i++)
+			{
+				self_->replica(i).write.set_auto_collect(budget);
+			}
+		}
+
+	private:
+
+		me_t* self_;
+	} write{this};
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// persistent vector ///////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Vector with structural sharing, meant to be stored inside a
+// stupid::object
+//
+// Elements are stored in a trie of fixed-size chunks. Copying the
+// vector only copies a reference to the root, and modifying a copy only
+// copies the chunks on the path to the modified element (O(log n)),
+// so the new version shares everything else with the old one:
+//
+//	stupid::object<stupid::persistent_vector<Clip>> clips;
+//
+//	clips.write.update_inplace([](stupid::persistent_vector<Clip>& clips)
+//	{
+//		clips.set(1234, new_clip);
+//	});
+//
+// Chunks are reference counted the same way as versions of a
+// stupid::object are, so a chunk is freed when the last version
+// sharing it is.
+//
+template <typename T, size_t Bits = 5>
+class persistent_vector
+{
+public:
+
+	static_assert(Bits > 0 && Bits < 16);
+
+	static inline constexpr size_t CHUNK_SIZE{ size_t(1) << Bits };
+
+	auto size() const { return size_; }
+	auto empty() const { return size_ == 0; }
+
+	auto operator[](size_t index) const -> const T&
+	{
+		assert (index < size_);
+
+		const node_t* node{&*root_};
+
+		for (auto level = shift_; level > 0; level -= Bits)
+		{
+			node = &*node->children[(index >> level) & MASK];
+		}
+
+		return node->values[index & MASK];
+	}
+
+	auto back() const -> const T& { return (*this)[size_ - 1]; }
+
+	auto set(size_t index, T value) -> void
+	{
+		assert (index < size_);
+
+		auto node{&detail::writable(root_)};
+
+		for (auto level = shift_; level > 0; level -= Bits)
+		{
+			node = &detail::writable(node->children[(index >> level) & MASK]);
+		}
+
+		node->values[index & MASK] = std::move(value);
+	}
+
+	auto push_back(T value) -> void
+	{
+		if (!root_)
+		{
+			root_ = make_path(0, std::move(value));
+			size_ = 1;
+			return;
+		}
+
+		// Root is full, grow a level
+		if (size_ == (size_t(1) << (shift_ + Bits)))
+		{
+			node_t root;
+
+			root.children.push_back(std::move(root_));
+			root.children.push_back(make_path(shift_, std::move(value)));
+
+			root_ = detail::make_ref(std::move(root));
+			shift_ += Bits;
+			size_++;
+			return;
+		}
+
+		auto node{&detail::writable(root_)};
+
+		for (auto level = shift_; level > 0; level -= Bits)
+		{
+			const auto child{(size_ >> level) & MASK};
+
+			if (child == node->children.size())
+			{
+				node->children.push_back(make_path(level - Bits, std::move(value)));
+				size_++;
+				return;
+			}
+
+			node = &detail::writable(node->children[child]);
+		}
+
+		node->values.push_back(std::move(value));
+		size_++;
+	}
+
+	auto pop_back() -> void
+	{
+		assert (size_ > 0);
+
+		if (--size_ == 0)
+		{
+			*this = {};
+			return;
+		}
+
+		pop(root_, shift_);
+
+		// Shrink a level if the root only has one child left
+		while (shift_ > 0 && root_->children.size() == 1)
+		{
+			auto child{root_->children.front()};
+
+			root_ = std::move(child);
+			shift_ -= Bits;
+		}
+	}
+
+	template <typename Fn>
+	auto for_each(Fn&& fn) const -> void
+	{
+		if (!root_) return;
+
+		visit(*root_, shift_, fn);
+	}
+
+private:
+
+	static inline constexpr size_t MASK{ CHUNK_SIZE - 1 };
+
+	struct node_t
+	{
+		std::vector<ref<node_t>> children;
+		std::vector<T> values;
+	};
+
+	using node_ref = ref<node_t>;
+
+	static auto make_path(size_t level, T value) -> node_ref
+	{
+		node_t node;
+
+		if (level == 0)
+		{
+			node.values.reserve(CHUNK_SIZE);
+			node.values.push_back(std::move(value));
+		}
+		else
+		{
+			node.children.push_back(make_path(level - Bits, std::move(value)));
+		}
+
+		return detail::make_ref(std::move(node));
+	}
+
+	// Remove the element at index size_ (which has already been
+	// decremented.) Returns false if the node ended up empty.
+	auto pop(node_ref& r, size_t level) -> bool
+	{
+		auto& node{detail::writable(r)};
+
+		if (level == 0)
+		{
+			node.values.pop_back();
+
+			return !node.values.empty();
+		}
+
+		const auto child{(size_ >> level) & MASK};
+
+		if (!pop(node.children[child], level - Bits))
+		{
+			node.children.pop_back();
+		}
+
+		return !node.children.empty();
+	}
+
+	template <typename Fn>
+	static auto visit(const node_t& node, size_t level, Fn& fn) -> void
+	{
+		if (level == 0)
+		{
+			for (const auto& value : node.values) fn(value);
+
+			return;
+		}
+
+		for (const auto& child : node.children) visit(*child, level - Bits, fn);
+	}
+
+	node_ref root_;
+	size_t shift_{0};
+	size_t size_{0};
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// persistent map //////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Hash map with structural sharing, meant to be stored inside a
+// stupid::object
+//
+// A hash array mapped trie (the CHAMP variant.) Each level of the trie
+// consumes 5 bits of the hash. Like stupid::persistent_vector, copying
+// the map is O(1) and modifying a copy only copies the nodes on the path
+// to the modified entry.
+//
+template <typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class persistent_map
+{
+public:
+
+	auto size() const { return size_; }
+	auto empty() const { return size_ == 0; }
+
+	// Returns nullptr if the key isn't in the map
+	auto find(const Key& key) const -> const Value*
+	{
+		if (!root_) return nullptr;
+
+		const auto hash{Hash{}(key)};
+
+		const node_t* node{&*root_};
+
+		for (size_t shift = 0; shift < HASH_BITS; shift += BITS)
+		{
+			const auto bit{bit_of(hash, shift)};
+
+			if (node->datamap & bit)
+			{
+				const auto& entry{node->data[index_of(node->datamap, bit)]};
+
+				return KeyEqual{}(entry.first, key) ? &entry.second : nullptr;
+			}
+
+			if (!(node->nodemap & bit)) return nullptr;
+
+			node = &*node->children[index_of(node->nodemap, bit)];
+		}
+
+		// Collision node
+		for (const auto& entry : node->data)
+		{
+			if (KeyEqual{}(entry.first, key)) return &entry.second;
+		}
+
+		return nullptr;
+	}
+
+	auto contains(const Key& key) const -> bool { return find(key); }
+
+	// Insert the value, or replace it if the key is already in
+	// the map
+	auto set(Key key, Value value) -> void
+	{
+		if (!root_) root_ = detail::make_ref(node_t{});
+
+		const auto hash{Hash{}(key)};
+
+		if (insert(root_, hash, 0, std::move(key), std::move(value))) size_++;
+	}
+
+	// Returns false if the key wasn't in the map
+	auto erase(const Key& key) -> bool
+	{
+		if (!root_) return false;
+
+		if (!remove(root_, Hash{}(key), 0, key)) return false;
+
+		if (--size_ == 0) root_ = {};
+
+		return true;
+	}
+
+	template <typename Fn>
+	auto for_each(Fn&& fn) const -> void
+	{
+		if (!root_) return;
+
+		visit(*root_, fn);
+	}
+
+private:
+
+	static inline constexpr size_t BITS{ 5 };
+	static inline constexpr size_t HASH_BITS{ sizeof(size_t) * 8 };
+
+	struct node_t
+	{
+		uint32_t datamap{};
+		uint32_t nodemap{};
+		std::vector<std::pair<Key, Value>> data;
+		std::vector<ref<node_t>> children;
+	};
+
+	using node_ref = ref<node_t>;
+
+	static auto bit_of(size_t hash, size_t shift) -> uint32_t
+	{
+		return uint32_t(1) << ((hash >> shift) & 31);
+	}
+
+	static auto index_of(uint32_t map, uint32_t bit) -> size_t
+	{
+		auto bits{map & (bit - 1)};
+		size_t count{0};
+
+		for (; bits; bits &= bits - 1) count++;
+
+		return count;
+	}
+
+	// Node holding two entries which collide at all the levels
+	// above this one
+	static auto merge(std::pair<Key, Value> a, size_t hash_a, std::pair<Key, Value> b, size_t hash_b, size_t shift) -> node_ref
+	{
+		node_t node;
+
+		if (shift >= HASH_BITS)
+		{
+			node.data.push_back(std::move(a));
+			node.data.push_back(std::move(b));
+
+			return detail::make_ref(std::move(node));
+		}
+
+		const auto bit_a{bit_of(hash_a, shift)};
+		const auto bit_b{bit_of(hash_b, shift)};
+
+		if (bit_a == bit_b)
+		{
+			node.nodemap = bit_a;
+			node.children.push_back(merge(std::move(a), hash_a, std::move(b), hash_b, shift + BITS));
+		}
+		else
+		{
+			node.datamap = bit_a | bit_b;
+
+			if (bit_a < bit_b)
+			{
+				node.data.push_back(std::move(a));
+				node.data.push_back(std::move(b));
+			}
+			else
+			{
+				node.data.push_back(std::move(b));
+				node.data.push_back(std::move(a));
+			}
+		}
+
+		return detail::make_ref(std::move(node));
+	}
+
+	// Returns true if a new entry was added
+	static auto insert(node_ref& r, size_t hash, size_t shift, Key key, Value value) -> bool
+	{
+		auto& node{detail::writable(r)};
+
+		if (shift >= HASH_BITS)
+		{
+			for (auto& entry : node.data)
+			{
+				if (!KeyEqual{}(entry.first, key)) continue;
+
+				entry.second = std::move(value);
+
+				return false;
+			}
+
+			node.data.emplace_back(std::move(key), std::move(value));
+
+			return true;
+		}
+
+		const auto bit{bit_of(hash, shift)};
+
+		if (node.datamap & bit)
+		{
+			const auto index{index_of(node.datamap, bit)};
+
+			auto& entry{node.data[index]};
+
+			if (KeyEqual{}(entry.first, key))
+			{
+				entry.second = std::move(value);
+
+				return false;
+			}
+
+			// Push both entries down a level
+			const auto other_hash{Hash{}(entry.first)};
+
+			auto child{merge(std::move(entry), other_hash, {std::move(key), std::move(value)}, hash, shift + BITS)};
+
+			node.data.erase(node.data.begin() + index);
+			node.datamap &= ~bit;
+			node.nodemap |= bit;
+			node.children.insert(node.children.begin() + index_of(node.nodemap, bit), std::move(child));
+
+			return true;
+		}
+
+		if (node.nodemap & bit)
+		{
+			return insert(node.children[index_of(node.nodemap, bit)], hash, shift + BITS, std::move(key), std::move(value));
+		}
+
+		node.datamap |= bit;
+		node.data.insert(node.data.begin() + index_of(node.datamap, bit), {std::move(key), std::move(value)});
+
+		return true;
+	}
+
+	// Returns true if the entry was found
+	static auto remove(node_ref& r, size_t hash, size_t shift, const Key& key) -> bool
+	{
+		if (shift >= HASH_BITS)
+		{
+			const auto& data{r->data};
+
+			for (size_t i = 0; i < data.size(); i++)
+			{
+				if (!KeyEqual{}(data[i].first, key)) continue;
+
+				auto& node{detail::writable(r)};
+
+				node.data.erase(node.data.begin() + i);
+
+				return true;
+			}
+
+			return false;
+		}
+
+		const auto bit{bit_of(hash, shift)};
+
+		if (r->datamap & bit)
+		{
+			const auto index{index_of(r->datamap, bit)};
+
+			if (!KeyEqual{}(r->data[index].first, key)) return false;
+
+			auto& node{detail::writable(r)};
+
+			node.data.erase(node.data.begin() + index);
+			node.datamap &= ~bit;
+
+			return true;
+		}
+
+		if (!(r->nodemap & bit)) return false;
+
+		const auto index{index_of(r->nodemap, bit)};
+
+		// Check before copying anything. If this node is ours
+		// alone then take the child out of it rather than
+		// copying the ref, otherwise the child would always look
+		// shared and be copied too.
+		const auto unique{detail::is_unique(r)};
+		auto child{unique ? std::move(detail::writable(r).children[index]) : r->children[index]};
+
+		if (!remove(child, hash, shift + BITS, key))
+		{
+			if (unique) detail::writable(r).children[index] = std::move(child);
+
+			return false;
+		}
+
+		auto& node{detail::writable(r)};
+
+		if (child->children.empty() && child->data.size() < 2)
+		{
+			// Not worth a node of its own anymore. Pull the
+			// remaining entry (if any) up into this one
+			node.children.erase(node.children.begin() + index);
+			node.nodemap &= ~bit;
+
+			if (!child->data.empty())
+			{
+				node.datamap |= bit;
+				node.data.insert(node.data.begin() + index_of(node.datamap, bit), child->data.front());
+			}
+
+			return true;
+		}
+
+		node.children[index] = std::move(child);
+
+		return true;
+	}
+
+	template <typename Fn>
+	static auto visit(const node_t& node, Fn& fn) -> void
+	{
+		for (const auto& entry : node.data) fn(entry.first, entry.second);
+		for (const auto& child : node.children) visit(*child, fn);
+	}
+
+	node_ref root_;
+	size_t size_{0};
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// ring ////////////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Bounded queues for things which are a stream of events rather than
+// a snapshot of state, e.g. note events or automation points, where
+// copying the whole state per event would be silly and triggers would
+// merge events together.
+//
+// All memory is allocated up front by the constructor. The capacity
+// is rounded up to a power of two.
+//
+// Values are handed over by the ring itself, so the reader can drain
+// it once per audio buffer without any other synchronization. If the
+// writer also notifies a sync_signal after pushing a batch, the reader
+// can skip draining when the signal hasn't moved.
+//
+namespace detail {
+
+inline auto ring_capacity(size_t capacity) -> size_t
+{
+	assert (capacity > 0 && capacity <= (std::numeric_limits<size_t>::max() >> 1) + 1);
+
+	size_t out{1};
+
+	while (out < capacity) out <<= 1;
+
+	return out;
+}
+
+template <typename T>
+struct ring_storage
+{
+	alignas(T) std::byte bytes[sizeof(T)];
+
+	auto get() -> T* { return std::launder(reinterpret_cast<T*>(bytes)); }
+};
+
+} // detail
+
+// Single producer, single consumer.
+//
+// push*() may only be called from one thread at a time, and pop*() or
+// drain() may only be called from one (other) thread at a time.
+template <typename T>
+class spsc_ring
+{
+public:
+
+	spsc_ring(size_t capacity)
+		: capacity_{detail::ring_capacity(capacity)}
+		, slots_{new detail::ring_storage<T>[capacity_]}
+	{
+	}
+
+	spsc_ring(const spsc_ring&) = delete;
+	auto operator=(const spsc_ring&) -> spsc_ring& = delete;
+
+	~spsc_ring()
+	{
+		drain([](T&&) {});
+	}
+
+	auto capacity() const { return capacity_; }
+
+	// Producer side. Returns false if the ring is full.
+	template <typename... Args>
+	auto emplace(Args&&... args) -> bool
+	{
+		const auto tail{producer_.tail.load(std::memory_order_relaxed)};
+
+		if (free_space(tail) < 1) return false;
+
+		new (slot(tail)) T{std::forward<Args>(args)...};
+
+		producer_.tail.store(tail + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	template <typename U>
+	auto push(U&& value) -> bool
+	{
+		return emplace(std::forward<U>(value));
+	}
+
+	// Producer side. Pushes as many of the count values starting at
+	// first as there is room for, and publishes them all at once.
+	// Returns the number pushed.
+	template <typename InputIt>
+	auto push_n(InputIt first, size_t count) -> size_t
+	{
+		const auto tail{producer_.tail.load(std::memory_order_relaxed)};
+
+		count = std::min(count, free_space(tail, count));
+
+		for (size_t i = 0; i < count; i++, ++first)
+		{
+			new (slot(tail + i)) T{*first};
+		}
+
+		producer_.tail.store(tail + count, std::memory_order_release);
+
+		return count;
+	}
+
+	// Producer side. True if there is room for count more values.
+	auto can_push(size_t count = 1) -> bool
+	{
+		return free_space(producer_.tail.load(std::memory_order_relaxed), count) >= count;
+	}
+
+	// Consumer side. Returns false if the ring is empty.
+	auto pop(T& out) -> bool
+	{
+		return pop_n(&out, 1) == 1;
+	}
+
+	// Consumer side. Moves up to max values to out and frees their
+	// slots all at once. Returns the number popped.
+	template <typename OutputIt>
+	auto pop_n(OutputIt out, size_t max) -> size_t
+	{
+		return consume(max, [&out](T&& value) { *out++ = std::move(value); });
+	}
+
+	// Consumer side. Calls fn(T&&) for every value currently in the
+	// ring. Returns the number of values.
+	template <typename Fn>
+	auto drain(Fn&& fn) -> size_t
+	{
+		return consume(std::numeric_limits<size_t>::max(), std::forward<Fn>(fn));
+	}
+
+	// Only a hint unless called from the consumer thread.
+	auto empty() const -> bool
+	{
+		return consumer_.head.load(std::memory_order_relaxed) == producer_.tail.load(std::memory_order_acquire);
+	}
+
+private:
+
+	auto slot(size_t index) -> T* { return slots_[index & (capacity_ - 1)].get(); }
+
+	// Only reloads the consumer's position if the cached one doesn't
+	// leave enough room, so the producer usually doesn't touch the
+	// consumer's cache line at all.
+	auto free_space(size_t tail, size_t wanted = 1) -> size_t
+	{
+		auto free{capacity_ - (tail - producer_.cached_head)};
+
+		if (free < wanted)
+		{
+			producer_.cached_head = consumer_.head.load(std::memory_order_acquire);
+			free = capacity_ - (tail - producer_.cached_head);
+		}
+
+		return free;
+	}
+
+	template <typename Fn>
+	auto consume(size_t max, Fn&& fn) -> size_t
+	{
+		const auto head{consumer_.head.load(std::memory_order_relaxed)};
+
+		auto available{consumer_.cached_tail - head};
+
+		if (available < max)
+		{
+			consumer_.cached_tail = producer_.tail.load(std::memory_order_acquire);
+			available = consumer_.cached_tail - head;
+		}
+
+		const auto count{std::min(available, max)};
+
+		for (size_t i = 0; i < count; i++)
+		{
+			const auto value{slot(head + i)};
+
+			fn(std::move(*value));
+
+			value->~T();
+		}
+
+		consumer_.head.store(head + count, std::memory_order_release);
+
+		return count;
+	}
+
+	struct alignas(detail::cache_line_size) producer_t
+	{
+		std::atomic<size_t> tail{0};
+		size_t cached_head{0};
+	};
+
+	struct alignas(detail::cache_line_size) consumer_t
+	{
+		std::atomic<size_t> head{0};
+		size_t cached_tail{0};
+	};
+
+	const size_t capacity_;
+	std::unique_ptr<detail::ring_storage<T>[]> slots_;
+	producer_t producer_;
+	consumer_t consumer_;
+};
+
+// Multiple producers, single consumer.
+//
+// push*() may be called from any number of threads at once, and pop*()
+// or drain() may only be called from one thread at a time.
+//
+// Producers claim slots with a compare_exchange on the tail, and each
+// slot carries a sequence number which says when it has been filled,
+// so the consumer stops at the first slot a producer is still writing.
+template <typename T>
+class mpsc_ring
+{
+public:
+
+	mpsc_ring(size_t capacity)
+		: capacity_{detail::ring_capacity(capacity)}
+		, slots_{new slot_t[capacity_]}
+	{
+	}
+
+	mpsc_ring(const mpsc_ring&) = delete;
+	auto operator=(const mpsc_ring&) -> mpsc_ring& = delete;
+
+	~mpsc_ring()
+	{
+		drain([](T&&) {});
+	}
+
+	auto capacity() const { return capacity_; }
+
+	// Producer side. Returns false if the ring is full.
+	template <typename... Args>
+	auto emplace(Args&&... args) -> bool
+	{
+		size_t count{1};
+
+		const auto tail{claim(count)};
+
+		if (tail == FULL) return false;
+
+		fill(tail, std::forward<Args>(args)...);
+
+		return true;
+	}
+
+	template <typename U>
+	auto push(U&& value) -> bool
+	{
+		return emplace(std::forward<U>(value));
+	}
+
+	// Producer side. Claims room for as many of the count values
+	// starting at first as will fit with a single compare_exchange.
+	// Returns the number pushed.
+	template <typename InputIt>
+	auto push_n(InputIt first, size_t count) -> size_t
+	{
+		const auto tail{claim(count)};
+
+		if (tail == FULL) return 0;
+
+		for (size_t i = 0; i < count; i++, ++first)
+		{
+			fill(tail + i, *first);
+		}
+
+		return count;
+	}
+
+	// Consumer side. Returns false if the ring is empty.
+	auto pop(T& out) -> bool
+	{
+		return pop_n(&out, 1) == 1;
+	}
+
+	// Consumer side. Moves up to max values to out. Returns the
+	// number popped.
+	template <typename OutputIt>
+	auto pop_n(OutputIt out, size_t max) -> size_t
+	{
+		return consume(max, [&out](T&& value) { *out++ = std::move(value); });
+	}
+
+	// Consumer side. Calls fn(T&&) for every value which has been
+	// completely pushed, in order, stopping at the first one which
+	// hasn't. Returns the number of values.
+	template <typename Fn>
+	auto drain(Fn&& fn) -> size_t
+	{
+		return consume(std::numeric_limits<size_t>::max(), std::forward<Fn>(fn));
+	}
+
+private:
+
+	static inline constexpr size_t FULL{std::numeric_limits<size_t>::max()};
+
+	struct slot_t
+	{
+		// Holds index + 1 once the value for that index is ready
+		std::atomic<size_t> sequence{0};
+		detail::ring_storage<T> storage;
+	};
+
+	// Returns the first claimed index, or FULL. On success, count is
+	// updated to the number of slots claimed.
+	auto claim(size_t& count) -> size_t
+	{
+		auto tail{producer_.tail.load(std::memory_order_relaxed)};
+
+		for (;;)
+		{
+			const auto head{consumer_.head.load(std::memory_order_acquire)};
+			const auto claimed{std::min(count, capacity_ - (tail - head))};
+
+			if (claimed < 1) return FULL;
+
+			if (producer_.tail.compare_exchange_weak(tail, tail + claimed, std::memory_order_relaxed, std::memory_order_relaxed))
+			{
+				count = claimed;
+
+				return tail;
+			}
+		}
+	}
+
+	template <typename... Args>
+	auto fill(size_t index, Args&&... args) -> void
+	{
+		auto& slot{slots_[index & (capacity_ - 1)]};
+
+		new (slot.storage.bytes) T{std::forward<Args>(args)...};
+
+		slot.sequence.store(index + 1, std::memory_order_release);
+	}
+
+	template <typename Fn>
+	auto consume(size_t max, Fn&& fn) -> size_t
+	{
+		const auto head{consumer_.head.load(std::memory_order_relaxed)};
+
+		size_t count{0};
+
+		for (; count < max; count++)
+		{
+			const auto index{head + count};
+
+			auto& slot{slots_[index & (capacity_ - 1)]};
+
+			if (slot.sequence.load(std::memory_order_acquire) != index + 1) break;
+
+			const auto value{slot.storage.get()};
+
+			fn(std::move(*value));
+
+			value->~T();
+		}
+
+		consumer_.head.store(head + count, std::memory_order_release);
+
+		return count;
+	}
+
+	struct alignas(detail::cache_line_size) producer_t
+	{
+		std::atomic<size_t> tail{0};
+	};
+
+	struct alignas(detail::cache_line_size) consumer_t
+	{
+		std::atomic<size_t> head{0};
+	};
+
+	const size_t capacity_;
+	std::unique_ptr<slot_t[]> slots_;
+	producer_t producer_;
+	consumer_t consumer_;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// sync signal /////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+namespace detail {
+
+// Orderings to use for each side of a flag or counter which was
+// given a single std::memory_order
+inline constexpr auto store_order(std::memory_order order) -> std::memory_order
+{
+	switch (order)
+	{
+		case std::memory_order_relaxed: return std::memory_order_relaxed;
+		case std::memory_order_seq_cst: return std::memory_order_seq_cst;
+		default: return std::memory_order_release;
+	}
+}
+
+inline constexpr auto load_order(std::memory_order order) -> std::memory_order
+{
+	switch (order)
+	{
+		case std::memory_order_relaxed: return std::memory_order_relaxed;
+		case std::memory_order_seq_cst: return std::memory_order_seq_cst;
+		default: return std::memory_order_acquire;
+	}
+}
+
+// True if counter value a comes after b, even if the counter has
+// wrapped around in between (as long as it hasn't gone more than
+// half way round.)
+template <typename U>
+constexpr auto is_newer(U a, U b) -> bool
+{
+	static_assert(std::is_unsigned_v<U>);
+
+	return std::make_signed_t<U>(a - b) > 0;
+}
+
+template <typename SignalType>
+using signal_value_t = std::decay_t<decltype(std::declval<const SignalType&>().get_value())>;
+
+} // detail
+
+//
+// Counter which is bumped by one thread (e.g. at the start of every
+// audio buffer) and polled by any number of others.
+//
+// Only one thread may call notify(). Other signal types can be used with
+// the signal synced objects below, as long as get_value() returns an
+// unsigned counter. Values are always compared with detail::is_newer()
+// so it's fine for the counter to wrap.
+//
+// The memory order decides what notify() publishes. With the default
+// (relaxed) the signal carries no data, it only says that time has
+// moved on. Pass std::memory_order_acq_rel to make anything written
+// before notify() visible to readers who see the new value.
+//
+class sync_signal
+{
+public:
+
+	sync_signal(std::memory_order memory_order = std::memory_order_relaxed)
+		: memory_order_{memory_order}
+	{
+	}
+
+	auto get_value() const -> uint64_t
+	{
+		return value_.load(detail::load_order(memory_order_));
+	}
+
+	// There is only ever one notifier, so this doesn't need to
+	// be a read-modify-write.
+	auto notify() -> void
+	{
+		value_.store(value_.load(std::memory_order_relaxed) + 1, detail::store_order(memory_order_));
+	}
+
+private:
+
+	std::memory_order memory_order_;
+	std::atomic<uint64_t> value_{0};
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// signal synced object ////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+template <class T, class SignalType = sync_signal>
+class signal_synced_object
+{
+public:
+
+	using me_t = signal_synced_object<T, SignalType>;
+	using object_t = object<T>;
+	using ref_t = ref<T>;
+
+private:
+
+	struct critical_t
+	{
+		template <typename... Args, typename = std::enable_if_t<!detail::is_self_v<critical_t, Args...>>>
+		critical_t(Args&&... args) : object{std::forward<Args>(args)...} {}
+
+		object_t object;
+		std::atomic_bool value_pending{true};
+	} critical_;
+
+public:
+
+	template <typename... Args>
+	signal_synced_object(const SignalType& signal, Args&&... args)
+		: critical_{std::forward<Args>(args)...}
+		, read{this, signal}
+	{
+	}
+
+	struct write_t;
+
+	struct read_t
+	{
+		read_t(me_t* self, const SignalType& signal) : self_{self}, signal_{&signal} {}
+
+		auto get_value() -> const T&
+		{
+			update();
+
+			return current_.get_value();
+		}
+
+		auto is_value_pending() const -> bool
+		{
+			return self_->critical_.value_pending.load();
+		}
+
+	private:
+
+		// The very first call always picks up the initial value,
+		// even if the signal hasn't been notified yet
+		auto update() -> void
+		{
+			const auto signal_value{signal_->get_value()};
+
+			if (!current_ || detail::is_newer(signal_value, slot_value_))
+			{
+				get_new_value_if_pending();
+			}
+
+			slot_value_ = signal_value;
+		}
+
+		auto get_new_value_if_pending() -> void
+		{
+			const auto value_pending{self_->critical_.value_pending.exchange(false)};
+
+			if (value_pending)
+			{
+				auto next{self_->critical_.object.read.acquire()};
+
+				// Versions never go backwards
+				assert (!current_ || next.generation() >= current_.generation());
+
+				current_ = std::move(next);
+				STUPID_STATS_ADD(signal_fetches);
+			}
+		}
+
+		me_t* self_;
+		const SignalType* signal_;
+		detail::signal_value_t<SignalType> slot_value_{0};
+		ref_t current_;
+
+		// The writer reads the signal through here too
+		friend struct write_t;
+	} read;
+
+	struct write_t
+	{
+		write_t(me_t* self) : self_{self} {}
+
+		// Staged edits which were never published are dropped.
+		// With STUPID_CHECKS that trips an assert instead, since
+		// it usually means a missing flush().
+		~write_t()
+		{
+#if defined(STUPID_CHECKS)
+			assert (!dirty_);
+#endif
+		}
+
+		auto get_value() -> const T&
+		{
+			return self_->critical_.object.read.get_value();
+		}
+
+		// Publishes immediately. Throws away any staged edits.
+		template <typename U>
+		auto set(U&& value) -> void
+		{
+			staged_.reset();
+			dirty_ = false;
+			self_->critical_.object.write.set(std::forward<U>(value));
+			self_->critical_.value_pending = true;
+		}
+
+		// Publishes immediately. Throws away any staged edits.
+		template <typename UpdateFn>
+		auto update(UpdateFn&& fn) -> void
+		{
+			staged_.reset();
+			dirty_ = false;
+			self_->critical_.object.write.update(std::forward<UpdateFn>(fn));
+			self_->critical_.value_pending = true;
+		}
+
+		//
+		// Coalescing writes
+		//
+		// For edits which arrive much faster than the reader can
+		// see them (mouse moves, automation.) stage() applies
+		// fn(T&) to a private copy of the value without publishing
+		// anything, and publish() publishes the staged copy only if
+		// the reader is ready for a new one. Call publish() as
+		// often as you like, e.g. after every event or once per UI
+		// frame, and at most one version is made per signal tick
+		// (or per value the reader picks up), however many edits
+		// were staged.
+		//
+		template <typename UpdateFn>
+		auto stage(UpdateFn&& fn) -> void
+		{
+			if (!staged_) staged_.emplace(get_value());
+
+			fn(*staged_);
+			dirty_ = true;
+		}
+
+		// If there are staged edits and the reader has either
+		// picked up the last value or the signal has moved on
+		// since it was published, publish them. Returns true if
+		// something was published.
+		auto publish() -> bool
+		{
+			if (!dirty_) return false;
+
+			const auto signal_value{self_->read.signal_->get_value()};
+
+			if (self_->critical_.value_pending.load() && !detail::is_newer(signal_value, published_at_))
+			{
+				return false;
+			}
+
+			publish_staged(signal_value);
+
+			return true;
+		}
+
+		// Publish any staged edits right now
+		auto flush() -> void
+		{
+			if (!dirty_) return;
+
+			publish_staged(self_->read.signal_->get_value());
+		}
+
+		auto has_staged() const -> bool
+		{
+			return dirty_;
+		}
+
+	private:
+
+		// The staged copy is kept, so the next stage() doesn't have
+		// to copy the value again
+		auto publish_staged(detail::signal_value_t<SignalType> signal_value) -> void
+		{
+			self_->critical_.object.write.set(*staged_);
+			self_->critical_.value_pending = true;
+			published_at_ = signal_value;
+			dirty_ = false;
+		}
+
+		me_t* self_;
+		std::optional<T> staged_;
+		bool dirty_{false};
+		detail::signal_value_t<SignalType> published_at_{0};
+	} write{this};
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// signal synced object multi //////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Like signal_synced_object, but with a fixed number of reader handles
+// so that several reader threads can each pick up every new value.
+//
+// Each reader thread must always use the same handle, and no two reader
+// threads may share one. Each handle keeps its own state on its own
+// cache line, so readers never write to the same memory as each other.
+//
+// The writer bumps a single generation counter per write, so waking up
+// the readers costs the same no matter how many there are.
+//
+template <class T, size_t Readers, class SignalType = sync_signal, class Policy = policy::refcount>
+class signal_synced_object_multi
+{
+public:
+
+	static_assert(Readers > 0);
+
+	using me_t = signal_synced_object_multi<T, Readers, SignalType, Policy>;
+	using object_t = object<T, Policy>;
+	using ref_t = ref<T>;
+
+private:
+
+	struct critical_t
+	{
+		template <typename... Args, typename = std::enable_if_t<!detail::is_self_v<critical_t, Args...>>>
+		critical_t(Args&&... args) : object{std::forward<Args>(args)...} {}
+
+		object_t object;
+		alignas(detail::cache_line_size) std::atomic<uint64_t> generation{1};
+	} critical_;
+
+public:
+
+	class reader_t
+	{
+	public:
+
+		auto get_value() -> const T&
+		{
+			update();
+
+			return current_.get_value();
+		}
+
+		auto is_value_pending() const -> bool
+		{
+			return self_->critical_.generation.load(std::memory_order_relaxed) != generation_;
+		}
+
+	private:
+
+		// The first call always picks up the initial value
+		auto update() -> void
+		{
+			const auto signal_value{signal_->get_value()};
+
+			if (!current_ || detail::is_newer(signal_value, slot_value_))
+			{
+				get_new_value_if_pending();
+			}
+
+			slot_value_ = signal_value;
+		}
+
+		auto get_new_value_if_pending() -> void
+		{
+			// Acquire, so that the version we acquire is at least
+			// as new as the generation we saw
+			const auto generation{self_->critical_.generation.load(std::memory_order_acquire)};
+
+			if (generation != generation_)
+			{
+				current_ = self_->critical_.object.read.acquire();
+				generation_ = generation;
+				STUPID_STATS_ADD(signal_fetches);
+			}
+		}
+
+		me_t* self_{};
+		const SignalType* signal_{};
+		detail::signal_value_t<SignalType> slot_value_{0};
+		uint64_t generation_{0};
+		ref_t current_;
+
+		friend class signal_synced_object_multi;
+	};
+
+	template <typename... Args>
+	signal_synced_object_multi(const SignalType& signal, Args&&... args)
+		: critical_{std::forward<Args>(args)...}
+	{
+		for (auto& reader : readers_)
+		{
+			reader.value.self_ = this;
+			reader.value.signal_ = &signal;
+		}
+	}
+
+	auto reader(size_t index) -> reader_t&
+	{
+		assert (index < Readers);
+
+		return readers_[index].value;
+	}
+
+	struct write_t
+	{
+		write_t(me_t* self) : self_{self} {}
+
+		auto get_value() -> const T&
+		{
+			return self_->critical_.object.read.get_value();
+		}
+
+		template <typename U>
+		auto set(U&& value) -> void
+		{
+			self_->critical_.object.write.set(std::forward<U>(value));
+			bump();
+		}
+
+		template <typename UpdateFn>
+		auto update(UpdateFn&& fn) -> void
+		{
+			self_->critical_.object.write.update(std::forward<UpdateFn>(fn));
+			bump();
+		}
+
+		template <typename UpdateFn>
+		auto update_inplace(UpdateFn&& fn) -> void
+		{
+			self_->critical_.object.write.update_inplace(std::forward<UpdateFn>(fn));
+			bump();
+		}
+
+	private:
+
+		// Only the writer touches this, so it doesn't need to be
+		// a read-modify-write
+		auto bump() -> void
+		{
+			auto& generation{self_->critical_.generation};
+
+			generation.store(generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+
+		me_t* self_;
+	} write{this};
+
+private:
+
+	struct alignas(detail::cache_line_size) padded_reader_t
+	{
+		reader_t value;
+	};
+
+	std::array<padded_reader_t, Readers> readers_;
+};
+
+/////////////////////////////////////////////////////////////////////////
+/// signal synced object cells //////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
+
+//
+// Like signal_synced_object, but the reader stores the values it picks
+// up in a fixed number of cells, e.g. one cell for the value currently
+// being played and one for the value being crossfaded to.
+//
+// Each cell keeps its version alive until it is refilled or released.
+// Call read.release(cell) to drop a cell's version at a point of your
+// choosing, or read.retire_after(n) to have cells which haven't been
+// used for n calls to update() released automatically. Either way the
+// version is only dropped on the reader thread; the writer still does
+// the actual reclaiming.
+//
+template <class T, size_t Cells, class SignalType = sync_signal>
+class signal_synced_object_cells
+{
+public:
+
+	static_assert(Cells > 0);
+
+	using me_t = signal_synced_object_cells<T, Cells, SignalType>;
+	using object_t = object<T>;
+	using ref_t = ref<T>;
+
+private:
+
+	struct critical_t
+	{
+		template <typename... Args, typename = std::enable_if_t<!detail::is_self_v<critical_t, Args...>>>
+		critical_t(Args&&... args) : object{std::forward<Args>(args)...} {}
+
+		object_t object;
+		std::atomic_bool value_pending{true};
+	} critical_;
+
+public:
+
+	template <typename... Args>
+	signal_synced_object_cells(const SignalType& signal, Args&&... args)
+		: critical_{std::forward<Args>(args)...}
+		, read{this, signal}
+	{
+	}
+
+	struct read_t
+	{
+		read_t(me_t* self, const SignalType& signal) : self_{self}, signal_{&signal} {}
+
+		// Get the value stored in the given cell.
+		// If there isn't one, fall back to the most recently filled
+		// cell. If none of the cells have a value, store the
+		// current value in the given cell.
+		auto get_value(size_t cell) -> const T&
+		{
+			assert(cell < Cells);
+
+			if (!filled_[cell])
+			{
+				if (const auto newest{newest_cell()}; newest < Cells)
+				{
+					cell = newest;
+				}
+				else
+				{
+					self_->critical_.value_pending = false;
+					fill(cell, self_->critical_.object.read.acquire());
+				}
+			}
+
+			used_[cell] = ticks_;
+
+			return current_[cell].get_value();
+		}
+
+		auto has_value(size_t cell) const -> bool
+		{
+			assert(cell < Cells);
+
+			return filled_[cell] != 0;
+		}
+
+		auto is_value_pending() const -> bool
+		{
+			return self_->critical_.value_pending.load();
+		}
+
+		// If there is a new value pending, store it in the
+		// given cell, but only if we were signalled
+		auto update(size_t cell) -> void
+		{
+			assert(cell < Cells);
+
+			ticks_++;
+
+			const auto signal_value{signal_->get_value()};
+
+			if (detail::is_newer(signal_value, slot_value_))
+			{
+				get_new_value_if_pending(cell);
+			}
+
+			slot_value_ = signal_value;
+
+			if (retire_after_ > 0)
+			{
+				retire_stale_cells();
+			}
+		}
+
+		// Drop the version stored in the given cell
+		auto release(size_t cell) -> void
+		{
+			assert(cell < Cells);
+
+			current_[cell] = {};
+			filled_[cell] = 0;
+		}
+
+		// From now on, each call to update() releases any cell
+		// which hasn't been filled or read for the given number of
+		// calls, except for the most recently filled one, which is
+		// always kept as a fallback. Pass 0 (the default) to keep
+		// cells until they are refilled or released.
+		auto retire_after(uint64_t updates) -> void
+		{
+			retire_after_ = updates;
+		}
+
+	private:
+
+		// If there is a new value pending,
+		// store it in the given cell
+		auto get_new_value_if_pending(size_t cell) -> void
+		{
+			const auto value_pending{self_->critical_.value_pending.exchange(false)};
+
+			if (value_pending)
+			{
+				fill(cell, self_->critical_.object.read.acquire());
+				STUPID_STATS_ADD(signal_fetches);
+			}
+		}
+
+		auto fill(size_t cell, ref_t value) -> void
+		{
+			current_[cell] = std::move(value);
+			filled_[cell] = ++fills_;
+			used_[cell] = ticks_;
 		}
 
-		auto acquire() const -> ref_t
+		// Returns Cells if none of the cells have a value
+		auto newest_cell() const -> size_t
 		{
-			const auto cb{self_->critical_.control_block.load()};
+			size_t out{Cells};
 
-			assert (cb);
+			for (size_t cell = 0; cell < Cells; cell++)
+			{
+				if (filled_[cell] && (out == Cells || filled_[cell] > filled_[out]))
+				{
+					out = cell;
+				}
+			}
 
-			return ref_t{cb};
+			return out;
 		}
 
-		auto get_value() const -> const T&
+		auto retire_stale_cells() -> void
 		{
-			const auto cb{self_->critical_.control_block.load()};
+			const auto newest{newest_cell()};
 
-			assert (cb);
+			for (size_t cell = 0; cell < Cells; cell++)
+			{
+				if (cell == newest || !filled_[cell]) continue;
 
-			return cb->value;
+				if (ticks_ - used_[cell] >= retire_after_)
+				{
+					release(cell);
+				}
+			}
 		}
 
-	private:
-
 		me_t* self_;
-	} read{this};
+		const SignalType* signal_;
+		detail::signal_value_t<SignalType> slot_value_{0};
+		std::array<ref_t, Cells> current_;
 
-	struct write_t
-	{
-		write_t(me_t* self)
-			: self_{self}
-		{
-			instance_ = ref_t{self_->critical_.control_block.load()};
-		}
+		// Order in which each cell was filled (0 means empty)
+		std::array<uint64_t, Cells> filled_{};
 
-		write_t(write_t&& rhs) noexcept
-		{
-			this->operator=(std::move(rhs));
-		}
+		// Value of ticks_ when each cell was last filled or read
+		std::array<uint64_t, Cells> used_{};
 
-		auto operator=(write_t&& rhs) noexcept -> write_t&
-		{
-			instance_ = std::move(rhs.instance_);
-			garbage_ = std::move(rhs.garbage_);
+		uint64_t fills_{0};
+		uint64_t ticks_{0};
+		uint64_t retire_after_{0};
+	} read;
 
-			return *this;
-		}
+	struct write_t
+	{
+		write_t(me_t* self) : self_{self} {}
 
 		template <typename U>
 		auto set(U&& value) -> void
 		{
-			// The old control block won't be reclaimed before
-			// the end of this function, because we keep this
-			// reference to it. So it won't be garbage collected
-			// yet when we call garbage_collect() at the end of
-			// this function.
-			const auto old_instance{instance_};
-
-			// Create the new control block
-			const auto cb{new cb_t{std::forward<U>(value), 0}};
-
-			// Atomically set the new control block
-			self_->critical_.control_block = cb;
-
-			// Keep a reference to the new control block
-			instance_ = ref_t{cb};
-
-			// Push the old control block onto the garbage. It
-			// won't be collected yet.
-			garbage_.push_back(old_instance);
-
-			// Collect old control blocks that were already
-			// discarded.
-			garbage_collect();
+			self_->critical_.object.write.set(std::forward<U>(value));
+			self_->critical_.value_pending = true;
 		}
 
 		template <typename UpdateFn>
 		auto update(UpdateFn&& fn) -> void
 		{
-			set(fn(*instance_));
+			self_->critical_.object.write.update(std::forward<UpdateFn>(fn));
+			self_->critical_.value_pending = true;
 		}
 
 	private:
 
-		auto garbage_collect() -> void
-		{
-			static const auto can_be_deleted = [](const ref_t& instance)
-			{
-				assert (instance.cb_);
-				assert (instance.cb_->ref_count > 0);
+		me_t* self_;
+	} write{this};
+};
 
-				return instance.cb_->ref_count == 1;
-			};
+template <class T, class SignalType = sync_signal>
+using signal_synced_object_pair = signal_synced_object_cells<T, 2, SignalType>;
 
-			garbage_.erase(std::remove_if(std::begin(garbage_), std::end(garbage_), can_be_deleted), std::end(garbage_));
-		}
+/////////////////////////////////////////////////////////////////////////
+/// delta object ////////////////////////////////////////////////////////
+/////////////////////////////////////////////////////////////////////////
 
-		me_t* self_;
-		ref_t instance_;
-		std::vector<ref_t> garbage_;
-	} write{this};
+namespace detail {
+
+struct apply_delta
+{
+	template <typename T, typename Delta>
+	auto operator()(T& value, const Delta& delta) const -> void { delta.apply(value); }
 };
 
-template <typename T>
-class ref
+} // detail
+
+//
+// For a big T which is edited in small steps. Instead of publishing a
+// whole new version per edit, the writer appends Delta records to a
+// log, and the reader applies the ones it hasn't seen yet to its own
+// replica of the value, once per signal tick.
+//
+// Apply{}(T&, const Delta&) applies a delta. By default it calls
+// delta.apply(value).
+//
+// The log is an spsc_ring of the given capacity. If the reader falls
+// so far behind that the log fills up, the writer stops logging and
+// the next time there is room (or the next time write.flush() is
+// called) it publishes a full checkpoint of its own copy, through an
+// ordinary object<T>, instead. The reader loads the checkpoint when
+// it finds a gap in the log. So an edit normally costs O(delta), and
+// only a reader which falls behind costs O(sizeof(T)).
+//
+// Only one thread may write and only one thread may read. The writer
+// should call write.flush() every so often (once per UI frame, say),
+// otherwise edits which were dropped from a full log won't reach the
+// reader until the next edit.
+//
+template <class T, class Delta, class SignalType = sync_signal, class Apply = detail::apply_delta>
+class delta_object
 {
 public:
 
-	using cb_t = detail::control_block<T>;
+	using me_t = delta_object<T, Delta, SignalType, Apply>;
 
-	ref() = default;
+private:
 
-	ref(cb_t* cb)
-		: cb_{cb}
+	struct checkpoint_t
 	{
-		assert (cb);
+		T value;
 
-		ref_add();
-	}
+		// Number of deltas included
+		uint64_t seq;
+	};
 
-	ref(ref<T>&& rhs) noexcept
+	struct record_t
 	{
-		if (cb_)
-		{
-			ref_sub();
-		}
+		uint64_t seq;
+		Delta delta;
+	};
 
-		cb_ = rhs.cb_;
-		rhs.cb_ = {};
-	}
-
-	ref(const ref<T>& rhs)
-		: cb_{rhs.cb_}
+	struct critical_t
 	{
-		if (!cb_) return;
+		critical_t(size_t log_capacity, const T& value)
+			: checkpoint{value, uint64_t{0}}
+			, log{log_capacity}
+		{
+		}
 
-		assert (cb_->ref_count > 0);
+		object<checkpoint_t, policy::epoch<1>> checkpoint;
+		spsc_ring<record_t> log;
+	} critical_;
 
-		ref_add();
-	}
+public:
 
-	~ref()
+	template <typename... Args>
+	delta_object(const SignalType& signal, size_t log_capacity, Args&&... args)
+		: critical_{log_capacity, T{std::forward<Args>(args)...}}
+		, read{this, signal}
+		, write{this}
 	{
-		if (!cb_) return;
-
-		ref_sub();
 	}
 
-	auto operator=(ref<T>&& rhs) noexcept -> ref<T>&
+	struct read_t
 	{
-		if (cb_)
+		read_t(me_t* self, const SignalType& signal)
+			: self_{self}
+			, signal_{&signal}
+			, replica_{self->critical_.checkpoint.read.get_value().value}
 		{
-			ref_sub();
 		}
 
-		cb_ = rhs.cb_;
-		rhs.cb_ = {};
+		// Applies any new deltas first, but only if we were
+		// signalled
+		auto get_value() -> const T&
+		{
+			const auto signal_value{signal_->get_value()};
 
-		return *this;
-	}
+			if (detail::is_newer(signal_value, slot_value_))
+			{
+				sync();
+			}
 
-	auto operator=(const ref<T>& rhs) -> ref<T>&
-	{
-		if (cb_)
-		{
-			ref_sub();
+			slot_value_ = signal_value;
+
+			return replica_;
 		}
 
-		cb_ = rhs.cb_;
+		// Applies any new deltas now
+		auto sync() -> void
+		{
+			load_checkpoint();
 
-		if (!cb_) return *this;
+			self_->critical_.log.drain([this](record_t&& record)
+			{
+				if (record.seq <= applied_) return;
 
-		assert (cb_->ref_count > 0);
+				// Some deltas were dropped, so there must be a
+				// checkpoint which covers them
+				if (record.seq != applied_ + 1)
+				{
+					load_checkpoint();
 
-		ref_add();
+					if (record.seq <= applied_) return;
+				}
 
-		return *this;
-	}
+				assert (record.seq == applied_ + 1);
 
-	auto& get_value() const { return cb_->value; }
-	auto operator*() const -> const T& { return cb_->value; }
-	auto operator->() const -> const T* { return &cb_->value; }
+				Apply{}(replica_, record.delta);
+				applied_ = record.seq;
+			});
+		}
 
-private:
+	private:
 
-	auto ref_add() -> void
-	{
-		assert (cb_);
+		auto load_checkpoint() -> void
+		{
+			const auto checkpoint{self_->critical_.checkpoint.read.acquire_if_newer(checkpoint_generation_)};
 
-		cb_->ref_count++;
-	}
+			if (!checkpoint) return;
 
-	auto ref_sub() -> void
+			checkpoint_generation_ = checkpoint.generation();
+
+			if (checkpoint->seq > applied_)
+			{
+				replica_ = checkpoint->value;
+				applied_ = checkpoint->seq;
+			}
+		}
+
+		me_t* self_;
+		const SignalType* signal_;
+		detail::signal_value_t<SignalType> slot_value_{0};
+		T replica_;
+		uint64_t applied_{0};
+		uint64_t checkpoint_generation_{1};
+	} read;
+
+	struct write_t
 	{
-		assert (cb_);
+		write_t(me_t* self)
+			: self_{self}
+			, value_{self->critical_.checkpoint.read.get_value().value}
+		{
+		}
 
-		if (cb_->ref_count.fetch_sub(1) == 1)
+		// The writer's own, authoritative copy
+		auto get_value() const -> const T&
 		{
-			delete cb_;
+			return value_;
 		}
-	}
 
-	cb_t* cb_{};
+		// Applies the delta to the writer's copy and logs it for
+		// the reader
+		auto push(const Delta& delta) -> void
+		{
+			Apply{}(value_, delta);
+			seq_++;
 
-	friend class object<T>;
-};
+			auto& log{self_->critical_.log};
 
-/////////////////////////////////////////////////////////////////////////
-/// sync signal /////////////////////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////
+			if (!stale_)
+			{
+				if (log.push(record_t{seq_, delta})) return;
 
-class sync_signal
-{
-public:
+				// The reader has fallen behind. Stop logging until
+				// there is room for it to catch up.
+				stale_ = true;
+				return;
+			}
 
-	auto get_value() const { return value_; }
-	auto notify() -> void { value_++; }
+			// This checkpoint includes the delta we just applied
+			if (log.can_push()) checkpoint();
+		}
 
-private:
+		// Replaces the whole value. Always publishes a checkpoint.
+		template <typename U>
+		auto set(U&& value) -> void
+		{
+			value_ = std::forward<U>(value);
+			seq_++;
+			checkpoint();
+		}
+
+		// If any deltas were dropped because the log was full,
+		// publish a checkpoint now
+		auto flush() -> void
+		{
+			if (stale_) checkpoint();
+		}
+
+	private:
 
-	uint32_t value_{0};
+		auto checkpoint() -> void
+		{
+			self_->critical_.checkpoint.write.set(checkpoint_t{value_, seq_});
+			stale_ = false;
+		}
+
+		me_t* self_;
+		T value_;
+		uint64_t seq_{0};
+
+		// True if deltas have been dropped since the last checkpoint
+		bool stale_{false};
+	} write;
 };
 
 /////////////////////////////////////////////////////////////////////////
-/// signal synced object ////////////////////////////////////////////////
+/// triple buffer ///////////////////////////////////////////////////////
 /////////////////////////////////////////////////////////////////////////
 
-template <class T, class SignalType = sync_signal>
-class signal_synced_object
+//
+// For small fixed-size state which is published often, e.g. meter
+// levels, playhead position or FFT frames. There is no allocation and no
+// reference counting. The three buffers are stored inline, each on its
+// own cache line.
+//
+// The writer fills in the back buffer and publishes it. The reader
+// calls fetch() to swap in the latest published frame, and
+// get_value() keeps returning that frame until the next successful
+// fetch(). Publishing and fetching each cost one atomic exchange on a
+// shared index word, and fetch() skips even that if nothing new has
+// been published.
+//
+// Only one thread may write and only one thread may read.
+//
+template <class T>
+class triple_buffer
 {
 public:
 
-	using me_t = signal_synced_object<T, SignalType>;
-	using object_t = object<T>;
-	using ref_t = ref<T>;
-
-private:
-
-	struct critical_t
-	{
-		template <typename... Args>
-		critical_t(Args... args) : object{args...} {}
-
-		object_t object;
-		std::atomic_bool value_pending{true};
-	} critical_;
-
-public:
+	using me_t = triple_buffer<T>;
 
-	template <typename... Args>
-	signal_synced_object(const SignalType& signal, Args... args)
-		: critical_{args...}
-		, read{this, signal}
+	triple_buffer(const T& initial_value = T{})
+		: buffers_{buffer_t{initial_value}, buffer_t{initial_value}, buffer_t{initial_value}}
 	{
 	}
 
+	triple_buffer(const triple_buffer&) = delete;
+	auto operator=(const triple_buffer&) -> triple_buffer& = delete;
+
 	struct read_t
 	{
-		read_t(me_t* self, const SignalType& signal) : self_{self}, signal_{&signal} {}
+		read_t(me_t* self) : self_{self} {}
 
-		auto get_value() -> const T&
+		// Returns true if a new frame was picked up
+		auto fetch() -> bool
 		{
-			update();
+			auto& middle{self_->middle_};
 
-			return current_.get_value();
-		}
+			if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
 
-		auto is_value_pending() const -> bool
-		{
-			return self_->critical_->value_pending.load();
-		}
+			front_ = middle.exchange(front_, std::memory_order_acq_rel) & INDEX;
 
-	private:
+			return true;
+		}
 
-		auto update() -> void
+		auto get_value() const -> const T&
 		{
-			const auto signal_value{signal_->get_value()};
-
-			if (signal_value > slot_value_)
-			{
-				get_new_value_if_pending();
-			}
-
-			slot_value_ = signal_value;
+			return self_->buffers_[front_].value;
 		}
 
-		auto get_new_value_if_pending() -> void
+		auto is_value_pending() const -> bool
 		{
-			const auto value_pending{self_->critical_.value_pending.exchange(false)};
-
-			if (value_pending)
-			{
-				current_ = self_->critical_.object.read.acquire();
-			}
+			return self_->middle_.load(std::memory_order_relaxed) & FRESH;
 		}
 
-		const SignalType* signal_;
-		uint32_t slot_value_{0};
-		ref_t current_;
+	private:
+
 		me_t* self_;
-	} read;
+		uint8_t front_{0};
+	} read{this};
 
 	struct write_t
 	{
 		write_t(me_t* self) : self_{self} {}
 
-		auto get_value() -> const T&
+		// The frame which will be published next. It holds whatever
+		// was in it when it was last handed back by the reader, so
+		// fill in all of it.
+		auto get() -> T&
 		{
-			return self_->critical_.object.read.get_value();
+			return self_->buffers_[back_].value;
 		}
 
-		template <typename U>
-		auto set(U&& value) -> void
+		auto publish() -> void
 		{
-			self_->critical_.object.write.set(std::forward<U>(value));
-			self_->critical_.value_pending = true;
+			back_ = self_->middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
 		}
 
-		template <typename UpdateFn>
-		auto update(UpdateFn&& fn) -> void
+		template <typename U>
+		auto set(U&& value) -> void
 		{
-			self_->critical_.object.write.update(std::forward<UpdateFn>(fn));
-			self_->critical_.value_pending = true;
+			get() = std::forward<U>(value);
+			publish();
 		}
 
 	private:
 
 		me_t* self_;
+		uint8_t back_{2};
 	} write{this};
-};
 
-/////////////////////////////////////////////////////////////////////////
-/// signal synced object pair ///////////////////////////////////////////
-/////////////////////////////////////////////////////////////////////////
+private:
 
+	static inline constexpr uint8_t INDEX{ 0x3 };
+	static inline constexpr uint8_t FRESH{ 0x4 };
+
+	struct alignas(detail::cache_line_size) buffer_t
+	{
+		T value;
+	};
+
+	std::array<buffer_t, 3> buffers_;
+	alignas(detail::cache_line_size) std::atomic<uint8_t> middle_{1};
+};
+
+//
+// A triple buffer whose reader only picks up a new frame when the
+// signal has been notified, so that it gets the same value for the
+// whole audio buffer, like signal_synced_object.
+//
 template <class T, class SignalType = sync_signal>
-class signal_synced_object_pair
+class signal_synced_triple_buffer
 {
 public:
 
-	using me_t = signal_synced_object_pair<T, SignalType>;
-	using object_t = object<T>;
-	using ref_t = ref<T>;
+	using me_t = signal_synced_triple_buffer<T, SignalType>;
 
 private:
 
-	struct critical_t
-	{
-		template <typename... Args>
-		critical_t(Args... args) : object{args...} {}
-
-		object_t object;
-		std::atomic_bool value_pending{true};
-	} critical_;
+	triple_buffer<T> buffer_;
 
 public:
 
-	template <typename... Args>
-	signal_synced_object_pair(const SignalType& signal, Args... args)
-		: critical_{args...}
+	signal_synced_triple_buffer(const SignalType& signal, const T& initial_value = T{})
+		: buffer_{initial_value}
 		, read{this, signal}
 	{
 	}
@@ -438,93 +5289,50 @@ public:
 	{
 		read_t(me_t* self, const SignalType& signal) : self_{self}, signal_{&signal} {}
 
-		// Get the value stored in the given cell.
-		// If there isn't one yet, fall back to the other cell.
-		// If there isn't a value in the other cell either,
-		// call update() to get the pending value (there should
-		// always be one waiting in this case.)
-		auto get_value(int8_t cell) -> const T&
+		auto get_value() -> const T&
 		{
-			assert(cell == 0 || cell == 1);
-
-			if (have_value_[cell])
-			{
-				return current_[cell].get_value();
-			}
+			const auto signal_value{signal_->get_value()};
 
-			if (have_value_[1-cell])
+			if (detail::is_newer(signal_value, slot_value_))
 			{
-				return current_[1-cell].get_value();
+				self_->buffer_.read.fetch();
 			}
 
-			update(cell);
-
-			assert(have_value_[cell]);
+			slot_value_ = signal_value;
 
-			return current_[cell].get_value();
+			return self_->buffer_.read.get_value();
 		}
 
 		auto is_value_pending() const -> bool
 		{
-			return self_->critical_.value_pending.load();
-		}
-
-		// If there is a new value pending, store it in the
-		// given cell, but only if we were signalled
-		auto update(int8_t cell) -> void
-		{
-			assert(cell == 0 || cell == 1);
-
-			const auto signal_value{signal_->get_value()};
-
-			if (signal_value > slot_value_)
-			{
-				get_new_value_if_pending(cell);
-			}
-
-			slot_value_ = signal_value;
+			return self_->buffer_.read.is_value_pending();
 		}
 
 	private:
 
-		// If there is a new value pending,
-		// store it in the given cell
-		auto get_new_value_if_pending(int8_t cell) -> void
-		{
-			assert(cell == 0 || cell == 1);
-
-			const auto value_pending{self_->critical_.value_pending.exchange(false)};
-
-			if (value_pending)
-			{
-				current_[cell] = self_->critical_.object.read.acquire();
-				have_value_[cell] = true;
-			}
-		}
-
-		const SignalType* signal_;
-		uint32_t slot_value_{0};
-		std::array<ref_t, 2> current_;
-		std::array<bool, 2> have_value_;
 		me_t* self_;
+		const SignalType* signal_;
+		detail::signal_value_t<SignalType> slot_value_{0};
 	} read;
 
 	struct write_t
 	{
 		write_t(me_t* self) : self_{self} {}
 
-		template <typename U>
-		auto set(U&& value) -> void
+		auto get() -> T&
 		{
-			self_->critical_.object.write.set(std::forward<U>(value));
-			self_->critical_.value_pending = true;
+			return self_->buffer_.write.get();
 		}
 
-		template <typename UpdateFn>
-		auto update(UpdateFn&& fn) -> void
+		auto publish() -> void
 		{
-			self_->critical_.object.write.update(std::forward<UpdateFn>(fn));
-			self_->critical_.value_pending = true;
+			self_->buffer_.write.publish();
+		}
+
+		template <typename U>
+		auto set(U&& value) -> void
+		{
+			self_->buffer_.write.set(std::forward<U>(value));
 		}
 
 	private:
@@ -533,67 +5341,155 @@ public:
 	} write{this};
 };
 
+//
+// A flag which one thread primes and another thread consumes
+//
+// wait() is only available if the standard library supports
+// std::atomic::wait (C++20). In that case priming is an exchange
+// rather than a store, so that it can tell whether anyone is waiting,
+// and it only calls notify if they are.
+//
 struct trigger
 {
 	trigger(std::memory_order memory_order = std::memory_order_relaxed)
 		: memory_order_ { memory_order }
 	{
-		flag_.clear();
-		flag_.test_and_set(memory_order);
 	}
 
 	auto operator()() -> void
 	{
-		flag_.clear(memory_order_);
+#if defined(__cpp_lib_atomic_wait)
+		if (state_.exchange(PRIMED, memory_order_) & WAITING)
+		{
+			state_.notify_all();
+		}
+#else
+		state_.store(PRIMED, detail::store_order(memory_order_));
+#endif
 	}
 
 	operator bool()
 	{
-		return !(flag_.test_and_set(memory_order_));
+		// Don't write to the cache line if we weren't primed
+		if (!(state_.load(std::memory_order_relaxed) & PRIMED)) return false;
+
+		return state_.fetch_and(~PRIMED, memory_order_) & PRIMED;
+	}
+
+#if defined(__cpp_lib_atomic_wait)
+	// Blocks until the trigger is primed, then resets it.
+	// Not for realtime threads.
+	auto wait() -> void
+	{
+		for (;;)
+		{
+			auto state{state_.load(std::memory_order_relaxed)};
+
+			if (state & PRIMED)
+			{
+				if (state_.fetch_and(~PRIMED, memory_order_) & PRIMED) return;
+
+				continue;
+			}
+
+			if (!(state & WAITING))
+			{
+				if (!state_.compare_exchange_weak(state, state | WAITING, std::memory_order_relaxed)) continue;
+			}
+
+			state_.wait(state | WAITING, std::memory_order_relaxed);
+		}
 	}
+#endif
 
 private:
 
+	static inline constexpr uint32_t PRIMED{ 1 };
+	static inline constexpr uint32_t WAITING{ 2 };
+
 	std::memory_order memory_order_;
-	std::atomic_flag flag_;
+	std::atomic<uint32_t> state_{ 0 };
 };
 
 //
-// Ball thrown between two players
+// Ball thrown between a fixed number of players
 //
-// Can be used to coordinate access to some memory between two threads
+// Can be used to coordinate access to some memory between that many
+// threads
 //
 // Only the player currently holding the ball is allowed to access the
 // memory
 //
 // Each player must poll by calling catch_ball(), to check
-// if the ball has been thrown back to them yet
+// if the ball has been thrown to them yet
+//
+// Calling throw_ball(), throw_next() or throw_to() when you don't have
+// the ball is invalid
+//
+// Throwing performs a release store
+// catch_ball() performs an acquire compare_exchange (if it succeeds)
 //
-// Calling throw_ball() when you don't have the ball is invalid
+// Player IDs go from 0 to Players - 1
 //
-// throw_ball() performs a release store
-// catch_ball() performs an acquire load (if it succeeds)
+// If the standard library supports std::atomic::wait (C++20), a
+// non-realtime player can also block in wait_catch() instead of
+// polling. In that case throwing is a release exchange rather than a
+// store, so that the thrower can see whether anyone is waiting, and
+// it only calls notify if they are.
 //
-class beach_ball
+template <int Players>
+class basic_beach_ball
 {
 public:
 
-	beach_ball(int first_catcher)
+	static_assert(Players >= 2 && Players < 0xFFFF);
+
+	basic_beach_ball(int first_catcher)
 	{
-		assert(first_catcher == 0 || first_catcher == 1);
+		assert(first_catcher >= 0 && first_catcher < Players);
 
 		thrown_to_.store(first_catcher, std::memory_order_relaxed);
 	}
 
 	// We're not allowed to call this unless we have the ball,
 	// i.e. catch_ball() must have returned true since our
-	// last call to throw_ball().
+	// last throw.
+	//
+	// Throws the ball to the next player in round-robin order.
+	// With two players that is always the other player.
+	template <int player>
+	auto throw_next() -> void
+	{
+		static_assert(player >= 0 && player < Players);
+
+		check_thrown(player);
+		hand_to((player + 1) % Players);
+	}
+
 	template <int player>
 	auto throw_ball() -> void
 	{
-		static_assert(player == 0 || player == 1);
+		throw_next<player>();
+	}
+
+	template <int player, int target>
+	auto throw_to() -> void
+	{
+		static_assert(player >= 0 && player < Players);
+		static_assert(target >= 0 && target < Players);
+
+		check_thrown(player);
+		hand_to(target);
+	}
+
+	template <int player>
+	auto throw_to(int target) -> void
+	{
+		static_assert(player >= 0 && player < Players);
+		assert(target >= 0 && target < Players);
 
-		thrown_to_.store(1 - player, std::memory_order_release);
+		check_thrown(player);
+		hand_to(target);
 	}
 
 	// Returns true if the ball is caught
@@ -606,46 +5502,157 @@ public:
 	template <int player>
 	auto catch_ball() -> bool
 	{
-		static_assert(player == 0 || player == 1);
+		static_assert(player >= 0 && player < Players);
+
+		auto tmp{ thrown_to_.load(std::memory_order_relaxed) };
+
+		if ((tmp & ~WAITING) != player)
+		{
+			STUPID_STATS_ADD(catch_failures);
+			return false;
+		}
+
+		STUPID_SCHEDULE_POINT();
+
+		const auto expected{tmp};
+
+		// Leave the waiting bit alone, it belongs to whoever else is
+		// waiting for the ball
+		if (thrown_to_.compare_exchange_weak(tmp, NO_PLAYER | (tmp & WAITING), std::memory_order_acquire, std::memory_order_relaxed))
+		{
+			check_caught(player);
+			return true;
+		}
+
+		STUPID_STATS_ADD(catch_failures);
+
+		// If the state did change, somebody set or cleared the
+		// waiting bit in between, which isn't spurious
+		if (tmp == expected) STUPID_STATS_ADD(catch_spurious_failures);
+
+		return false;
+	}
+
+#if defined(__cpp_lib_atomic_wait)
+	// Blocks until the ball is thrown to this player, then catches it.
+	// Not for realtime threads.
+	template <int player>
+	auto wait_catch() -> void
+	{
+		static_assert(player >= 0 && player < Players);
+
+		for (;;)
+		{
+			if (catch_ball<player>()) return;
 
-		int tmp{ player };
+			auto tmp{ thrown_to_.load(std::memory_order_relaxed) };
 
-		return thrown_to_.compare_exchange_weak(tmp, NO_PLAYER, std::memory_order_acquire, std::memory_order_relaxed);
+			if ((tmp & ~WAITING) == player) continue;
+
+			if (!(tmp & WAITING))
+			{
+				if (!thrown_to_.compare_exchange_weak(tmp, tmp | WAITING, std::memory_order_relaxed)) continue;
+			}
+
+			thrown_to_.wait(tmp | WAITING, std::memory_order_relaxed);
+		}
 	}
+#endif
 
 private:
 
-	static inline constexpr int NO_PLAYER{ -1 };
+	static inline constexpr int NO_PLAYER{ 0xFFFF };
+	static inline constexpr int WAITING{ 0x10000 };
+
+#if defined(STUPID_CHECKS)
+	auto check_caught(int player) -> void
+	{
+		[[maybe_unused]] const auto holder{holder_.exchange(player, std::memory_order_relaxed)};
+
+		// Nobody else can be holding the ball
+		assert (holder == NO_PLAYER);
+	}
+
+	auto check_thrown([[maybe_unused]] int player) -> void
+	{
+		[[maybe_unused]] const auto holder{holder_.exchange(NO_PLAYER, std::memory_order_relaxed)};
+
+		// Only whoever is holding the ball may throw it
+		assert (holder == player);
+	}
+
+	std::atomic<int> holder_{NO_PLAYER};
+#else
+	auto check_caught(int) -> void {}
+	auto check_thrown(int) -> void {}
+#endif
+
+	auto hand_to(int target) -> void
+	{
+#if defined(__cpp_lib_atomic_wait)
+		if (thrown_to_.exchange(target, std::memory_order_release) & WAITING)
+		{
+			thrown_to_.notify_all();
+		}
+#else
+		thrown_to_.store(target, std::memory_order_release);
+#endif
+	}
 
 	std::atomic<int> thrown_to_;
 };
 
-template <int player>
+// The original two player ball
+using beach_ball = basic_beach_ball<2>;
+
+template <int player, int Players = 2>
 class beach_ball_player
 {
 public:
 
-	beach_ball* const ball;
+	basic_beach_ball<Players>* const ball;
 
-	beach_ball_player(beach_ball* ball_)
+	beach_ball_player(basic_beach_ball<Players>* ball_)
 		: ball{ ball_ }
 	{
-		static_assert(player == 0 || player == 1);
+		static_assert(player >= 0 && player < Players);
 	}
 
 	auto throw_ball() -> void
+	{
+		throw_next();
+	}
+
+	auto throw_next() -> void
+	{
+		assert(have_ball_);
+
+		have_ball_ = false;
+		ball->template throw_next<player>();
+	}
+
+	template <int target>
+	auto throw_to() -> void
+	{
+		assert(have_ball_);
+
+		have_ball_ = false;
+		ball->template throw_to<player, target>();
+	}
+
+	auto throw_to(int target) -> void
 	{
 		assert(have_ball_);
 
 		have_ball_ = false;
-		ball->throw_ball<player>();
+		ball->template throw_to<player>(target);
 	}
 
 	auto catch_ball() -> bool
 	{
 		assert(!have_ball_);
 
-		if (ball->catch_ball<player>())
+		if (ball->template catch_ball<player>())
 		{
 			have_ball_ = true;
 		}
@@ -653,6 +5660,22 @@ public:
 		return have_ball_;
 	}
 
+#if defined(__cpp_lib_atomic_wait)
+	auto wait_catch() -> void
+	{
+		assert(!have_ball_);
+
+		ball->template wait_catch<player>();
+		have_ball_ = true;
+	}
+
+	// Blocks until we have the ball
+	auto wait() -> void
+	{
+		if (!have_ball_) wait_catch();
+	}
+#endif
+
 	auto have_ball() const -> bool
 	{
 		return have_ball_;
@@ -673,4 +5696,175 @@ private:
 	bool have_ball_{};
 };
 
+//
+// Like basic_beach_ball, but the memory is split into a fixed number
+// of chunks (at most 64), and each chunk has its own ball. That way one
+// player can keep working on some chunks while another player works on
+// the others, instead of them taking turns with the whole thing.
+//
+// Sets of chunks are passed around as bitmasks (bit i is chunk i) and
+// any number of chunks can be caught or thrown with one atomic
+// operation.
+//
+// Each player has a mask of the chunks which have been thrown to them
+// and not caught yet. Chunks which have been caught aren't in anyone's
+// mask until they are thrown again.
+//
+// Calling throw_chunks() or throw_to() with chunks you aren't holding
+// is invalid
+//
+// Throwing performs a release fetch_or
+// catch_chunks() performs an acquire fetch_and (if there is anything
+// to catch)
+//
+template <size_t Chunks, int Players = 2>
+class partitioned_beach_ball
+{
+public:
+
+	static_assert(Chunks > 0 && Chunks <= 64);
+	static_assert(Players >= 2);
+
+	using mask_t = uint64_t;
+
+	static inline constexpr mask_t ALL{Chunks == 64 ? ~mask_t(0) : (mask_t(1) << Chunks) - 1};
+
+	static constexpr auto chunk(size_t index) -> mask_t
+	{
+		assert (index < Chunks);
+
+		return mask_t(1) << index;
+	}
+
+	// Chunks [begin, end)
+	static constexpr auto range(size_t begin, size_t end) -> mask_t
+	{
+		assert (begin <= end && end <= Chunks);
+
+		if (begin == end) return 0;
+
+		return (ALL >> (Chunks - (end - begin))) << begin;
+	}
+
+	// All chunks start off thrown to first_catcher
+	partitioned_beach_ball(int first_catcher)
+	{
+		assert(first_catcher >= 0 && first_catcher < Players);
+
+		thrown_to_[first_catcher].value.store(ALL, std::memory_order_relaxed);
+	}
+
+	// Throws the chunks to the next player in round-robin order
+	template <int player>
+	auto throw_chunks(mask_t chunks) -> void
+	{
+		static_assert(player >= 0 && player < Players);
+
+		throw_to<player>((player + 1) % Players, chunks);
+	}
+
+	template <int player>
+	auto throw_to(int target, mask_t chunks) -> void
+	{
+		static_assert(player >= 0 && player < Players);
+		assert(target >= 0 && target < Players);
+		assert((chunks & ~ALL) == 0);
+
+		if (!chunks) return;
+
+		thrown_to_[target].value.fetch_or(chunks, std::memory_order_release);
+	}
+
+	// Tries to catch the requested chunks. Returns the ones which
+	// were caught, which may be fewer than were asked for.
+	template <int player>
+	auto catch_chunks(mask_t chunks = ALL) -> mask_t
+	{
+		static_assert(player >= 0 && player < Players);
+
+		auto& thrown{thrown_to_[player].value};
+
+		// Don't write to the cache line if there's nothing to catch
+		if (!(thrown.load(std::memory_order_relaxed) & chunks)) return 0;
+
+		return thrown.fetch_and(~chunks, std::memory_order_acquire) & chunks;
+	}
+
+private:
+
+	struct alignas(detail::cache_line_size) padded_mask_t
+	{
+		std::atomic<mask_t> value{0};
+	};
+
+	std::array<padded_mask_t, Players> thrown_to_;
+};
+
+// Keeps track of which chunks a player is holding
+template <int player, size_t Chunks, int Players = 2>
+class partitioned_beach_ball_player
+{
+public:
+
+	using ball_t = partitioned_beach_ball<Chunks, Players>;
+	using mask_t = typename ball_t::mask_t;
+
+	ball_t* const ball;
+
+	partitioned_beach_ball_player(ball_t* ball_)
+		: ball{ ball_ }
+	{
+		static_assert(player >= 0 && player < Players);
+	}
+
+	auto throw_chunks(mask_t chunks) -> void
+	{
+		assert((held_ & chunks) == chunks);
+
+		held_ &= ~chunks;
+		ball->template throw_chunks<player>(chunks);
+	}
+
+	auto throw_to(int target, mask_t chunks) -> void
+	{
+		assert((held_ & chunks) == chunks);
+
+		held_ &= ~chunks;
+		ball->template throw_to<player>(target, chunks);
+	}
+
+	// Tries to catch any of the requested chunks which we aren't
+	// already holding. Returns the ones we are now holding.
+	auto catch_chunks(mask_t chunks = ball_t::ALL) -> mask_t
+	{
+		if (const auto missing{chunks & ~held_})
+		{
+			held_ |= ball->template catch_chunks<player>(missing);
+		}
+
+		return held_ & chunks;
+	}
+
+	// Returns true if we are holding all of the requested chunks,
+	// catching any which we aren't if possible
+	auto ensure(mask_t chunks) -> bool
+	{
+		return catch_chunks(chunks) == chunks;
+	}
+
+	auto held() const -> mask_t
+	{
+		return held_;
+	}
+
+	auto have_chunk(size_t index) const -> bool
+	{
+		return held_ & ball_t::chunk(index);
+	}
+
+private:
+
+	mask_t held_{};
+};
+
 } // stupid
@@ -0,0 +1,97 @@
+#pragma once
+
+//
+// Shared by the stress tests. Turns on the library's testing hooks
+// before including it: every schedule point yields now and then, to
+// shake up the interleavings, STUPID_CHECKS marks control blocks dead
+// when they are destroyed, and STUPID_STATS lets tests look at the
+// writer's garbage.
+//
+// The tests are meant to be run under ThreadSanitizer or
+// AddressSanitizer (configure with -DSTUPID_SANITIZER=thread or
+// address), which catch the races and lifetime bugs. The checks here
+// catch the rest: torn or out of order values.
+//
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace stress {
+
+inline auto schedule_point() -> void
+{
+	thread_local std::minstd_rand rng{std::random_device{}()};
+
+	if ((rng() & 7) == 0) std::this_thread::yield();
+}
+
+} // stress
+
+#define STUPID_SCHEDULE_POINT() ::stress::schedule_point()
+#ifndef STUPID_CHECKS
+#define STUPID_CHECKS
+#endif
+#ifndef STUPID_STATS
+#define STUPID_STATS
+#endif
+#include <stupid/stupid.hpp>
+
+// Unlike assert, still checks with NDEBUG defined
+#define STRESS_CHECK(x) \
+	do { if (!(x)) { std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #x); std::abort(); } } while (0)
+
+namespace stress {
+
+// Runs fn(index) on count threads, and waits for all of them
+template <typename Fn>
+auto run_threads(int count, Fn&& fn) -> void
+{
+	std::vector<std::thread> threads;
+
+	for (int i = 0; i < count; i++)
+	{
+		threads.emplace_back([&fn, i] { fn(i); });
+	}
+
+	for (auto& thread : threads) thread.join();
+}
+
+// Readers keep checking until the writer is done
+class stop_flag
+{
+public:
+
+	auto stop() -> void { stopped_.store(true, std::memory_order_release); }
+	auto stopped() const -> bool { return stopped_.load(std::memory_order_acquire); }
+
+private:
+
+	std::atomic<bool> stopped_{false};
+};
+
+// Runs each test in turn, printing its name first so that a failure
+// shows where it happened
+struct test
+{
+	const char* name;
+	void (*fn)();
+};
+
+template <size_t N>
+auto run(const test (&tests)[N]) -> int
+{
+	for (const auto& test : tests)
+	{
+		std::printf("%s\n", test.name);
+		std::fflush(stdout);
+		test.fn();
+	}
+
+	return 0;
+}
+
+} // stress
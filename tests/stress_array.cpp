@@ -0,0 +1,125 @@
+#include "stress.hpp"
+
+#include <array>
+#include <string>
+
+namespace {
+
+constexpr int READERS{3};
+constexpr size_t ELEMENTS{16};
+constexpr uint64_t WRITES{20000};
+
+struct frame
+{
+	uint64_t index;
+	uint64_t values[6];
+
+	static auto make(uint64_t index, uint64_t n) -> frame
+	{
+		frame out{index, {}};
+
+		for (auto& value : out.values) value = n;
+
+		return out;
+	}
+
+	auto consistent(uint64_t expected_index) const -> bool
+	{
+		if (index != expected_index) return false;
+
+		for (const auto value : values)
+		{
+			if (value != values[0]) return false;
+		}
+
+		return true;
+	}
+};
+
+// Every element only ever goes forwards, and a batch acquire never
+// returns a torn or misplaced element
+auto fixed_array() -> void
+{
+	stupid::object_array<frame, ELEMENTS, stupid::policy::epoch<4>> array;
+	stress::stop_flag done;
+
+	for (size_t i = 0; i < ELEMENTS; i++) array.write.set(i, frame::make(i, 0));
+
+	stress::run_threads(READERS + 1, [&](int index)
+	{
+		if (index == 0)
+		{
+			for (uint64_t i = 1; i <= WRITES; i++) array.write.set(i % ELEMENTS, frame::make(i % ELEMENTS, i));
+
+			done.stop();
+			return;
+		}
+
+		std::array<uint64_t, ELEMENTS> last{};
+		std::array<stupid::ref<frame>, ELEMENTS> refs;
+
+		while (!done.stopped())
+		{
+			array.read.acquire_n(0, ELEMENTS, refs.begin());
+
+			for (size_t i = 0; i < ELEMENTS; i++)
+			{
+				STRESS_CHECK(refs[i]->consistent(i));
+				STRESS_CHECK(refs[i]->values[0] >= last[i]);
+
+				last[i] = refs[i]->values[0];
+			}
+		}
+	});
+}
+
+// A dynamic array of non-trivial values sharing a pool which runs out
+auto dynamic_array_with_pool() -> void
+{
+	stupid::pool<std::string> pool{8};
+	stress::stop_flag done;
+
+	{
+		stupid::dynamic_object_array<std::string, stupid::policy::epoch<4>> array{ELEMENTS, pool, std::string(32, 'a')};
+
+		stress::run_threads(READERS + 1, [&](int index)
+		{
+			if (index == 0)
+			{
+				for (uint64_t i = 1; i <= WRITES / 4; i++)
+				{
+					array.write.update_inplace(i % ELEMENTS, [i](std::string& value) { value.assign(32, char('a' + i % 26)); });
+				}
+
+				done.stop();
+				return;
+			}
+
+			const std::array<size_t, 4> indices{1, 5, 9, 13};
+			std::array<stupid::ref<std::string>, 4> refs;
+
+			while (!done.stopped())
+			{
+				array.read.acquire(indices.begin(), indices.end(), refs.begin());
+
+				for (const auto& ref : refs)
+				{
+					STRESS_CHECK(ref->size() == 32);
+					STRESS_CHECK(ref->find_first_not_of(ref->front()) == std::string::npos);
+				}
+			}
+		});
+	}
+}
+
+} // namespace
+
+int main()
+{
+	static const stress::test tests[] = {
+		{"fixed_array", fixed_array},
+		{"dynamic_array_with_pool", dynamic_array_with_pool},
+	};
+
+	return stress::run(tests);
+}
@@ -0,0 +1,191 @@
+#include "stress.hpp"
+
+namespace {
+
+constexpr uint64_t FRAMES{20000};
+
+struct frame
+{
+	uint64_t values[8];
+
+	static auto make(uint64_t n) -> frame
+	{
+		frame out;
+
+		for (auto& value : out.values) value = n;
+
+		return out;
+	}
+
+	auto consistent() const -> bool
+	{
+		for (const auto value : values)
+		{
+			if (value != values[0]) return false;
+		}
+
+		return true;
+	}
+};
+
+// The reader only ever sees whole frames, never goes backwards, and
+// always ends up with the last one
+auto triple_buffer() -> void
+{
+	stupid::triple_buffer<frame> buffer{frame::make(0)};
+	stress::stop_flag done;
+
+	stress::run_threads(2, [&](int index)
+	{
+		if (index == 0)
+		{
+			for (uint64_t i = 1; i <= FRAMES; i++)
+			{
+				// Fill in the back buffer in place half the time
+				if (i % 2)
+				{
+					buffer.write.get() = frame::make(i);
+					buffer.write.publish();
+				}
+				else
+				{
+					buffer.write.set(frame::make(i));
+				}
+			}
+
+			done.stop();
+			return;
+		}
+
+		uint64_t last{0};
+
+		for (;;)
+		{
+			const auto stopped{done.stopped()};
+
+			buffer.read.fetch();
+
+			const auto& value{buffer.read.get_value()};
+
+			STRESS_CHECK(value.consistent());
+			STRESS_CHECK(value.values[0] >= last);
+
+			last = value.values[0];
+
+			if (stopped) break;
+		}
+
+		STRESS_CHECK(last == FRAMES);
+	});
+}
+
+// Player IDs are template arguments, so pick the right player type for
+// a thread index at runtime
+template <int Players, int Id = 0, typename Play>
+auto play_as(int index, stupid::basic_beach_ball<Players>& ball, Play& play) -> void
+{
+	if constexpr (Id < Players)
+	{
+		if (index != Id) return play_as<Players, Id + 1>(index, ball, play);
+
+		stupid::beach_ball_player<Id, Players> player{&ball};
+
+		play(player, Id);
+	}
+}
+
+// The ball goes round the players in turn. Whoever holds it reads and
+// writes plain memory, which ThreadSanitizer reports unless throwing
+// and catching order the accesses. If Block is set, every player but
+// the first blocks in wait_catch() instead of polling.
+template <int Players, bool Block = false>
+auto beach_ball() -> void
+{
+	constexpr uint64_t ROUNDS{5000};
+
+	stupid::basic_beach_ball<Players> ball{0};
+	uint64_t turns{0};
+	int last_player{Players - 1};
+
+	const auto play = [&](auto& player, int id)
+	{
+		for (uint64_t round = 0; round < ROUNDS; round++)
+		{
+#if defined(__cpp_lib_atomic_wait)
+			if (Block && id > 0)
+			{
+				player.wait_catch();
+			}
+			else
+#endif
+			{
+				while (!player.catch_ball()) std::this_thread::yield();
+			}
+
+			STRESS_CHECK(last_player == (id + Players - 1) % Players);
+			STRESS_CHECK(turns == round * Players + id);
+
+			last_player = id;
+			turns++;
+
+			player.throw_ball();
+		}
+	};
+
+	stress::run_threads(Players, [&](int index) { play_as<Players>(index, ball, play); });
+
+	STRESS_CHECK(turns == ROUNDS * Players);
+}
+
+#if defined(__cpp_lib_atomic_wait)
+// Two threads take turns, each blocking on its own trigger
+auto trigger_wait() -> void
+{
+	constexpr uint64_t ROUNDS{5000};
+
+	stupid::trigger ping{std::memory_order_acq_rel};
+	stupid::trigger pong{std::memory_order_acq_rel};
+	uint64_t turns{0};
+
+	stress::run_threads(2, [&](int index)
+	{
+		for (uint64_t round = 0; round < ROUNDS; round++)
+		{
+			if (index == 0)
+			{
+				STRESS_CHECK(turns == round * 2);
+				turns++;
+				ping();
+				pong.wait();
+			}
+			else
+			{
+				ping.wait();
+				STRESS_CHECK(turns == round * 2 + 1);
+				turns++;
+				pong();
+			}
+		}
+	});
+
+	STRESS_CHECK(turns == ROUNDS * 2);
+}
+#endif
+
+} // namespace
+
+int main()
+{
+	static const stress::test tests[] = {
+		{"triple_buffer", triple_buffer},
+		{"beach_ball<2>", beach_ball<2>},
+		{"beach_ball<3>", beach_ball<3>},
+#if defined(__cpp_lib_atomic_wait)
+		{"beach_ball<2> wait_catch", beach_ball<2, true>},
+		{"beach_ball<3> wait_catch", beach_ball<3, true>},
+		{"trigger_wait", trigger_wait},
+#endif
+	};
+
+	return stress::run(tests);
+}
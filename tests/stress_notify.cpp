@@ -0,0 +1,192 @@
+#include "stress.hpp"
+
+#include <optional>
+
+#if defined(__cpp_lib_coroutine)
+#include <coroutine>
+#include <exception>
+#endif
+
+namespace {
+
+constexpr uint64_t WRITES{20000};
+
+using object_t = stupid::object<uint64_t, stupid::policy::epoch<4>>;
+
+// Readers subscribe and unsubscribe over and over while the writer
+// publishes. Subscribers only ever see versions going forwards.
+auto subscription_churn() -> void
+{
+	object_t object{uint64_t{0}};
+	stress::stop_flag done;
+	std::atomic<uint64_t> calls{0};
+
+	stress::run_threads(3, [&](int index)
+	{
+		if (index == 0)
+		{
+			for (uint64_t i = 1; i <= WRITES; i++) object.write.set(i);
+
+			done.stop();
+			return;
+		}
+
+		while (!done.stopped())
+		{
+			// Shared with the callback, which may run once more
+			// after the subscription is reset on this thread
+			const auto last{std::make_shared<std::atomic<uint64_t>>(0)};
+
+			auto subscription{object.read.subscribe([&calls, last](const stupid::ref<uint64_t>& version)
+			{
+				STRESS_CHECK(*version >= last->load());
+				last->store(*version);
+				calls++;
+			})};
+
+			std::this_thread::yield();
+		}
+	});
+}
+
+// Subscribers publish, subscribe and unsubscribe from inside their
+// callbacks. This used to deadlock on the notifier's lock.
+auto reentrant_subscribers() -> void
+{
+	object_t object{uint64_t{0}};
+	std::optional<object_t::subscription_t> inner;
+	uint64_t inner_calls{0};
+
+	auto chain{object.read.subscribe([&](const stupid::ref<uint64_t>& version)
+	{
+		// Every version published by the outer write.set() below
+		// bumps the value until it is a multiple of 10
+		if (*version % 10) object.write.set(*version + 1);
+	})};
+
+	// Subscribes at the end of one outer write.set(), so that the
+	// next one calls the new subscriber, and unsubscribes at the end
+	// of the one after that
+	auto toggle{object.read.subscribe([&](const stupid::ref<uint64_t>& version)
+	{
+		if (*version % 30 == 10) inner = object.read.subscribe([&](const stupid::ref<uint64_t>&) { inner_calls++; });
+		if (*version % 30 == 0) inner.reset();
+	})};
+
+	for (uint64_t i = 1; i <= 100; i++)
+	{
+		object.write.set(uint64_t{i * 10 - 9});
+
+		STRESS_CHECK(object.read.get_value() == i * 10);
+	}
+
+	STRESS_CHECK(inner_calls > 0);
+}
+
+// A subscription may be reset or destroyed after its object is gone
+auto subscription_outlives_object() -> void
+{
+	object_t::subscription_t late;
+
+	{
+		object_t object{uint64_t{0}};
+
+		late = object.read.subscribe([](const stupid::ref<uint64_t>&) {});
+
+		object.write.set(uint64_t{1});
+
+		object_t moved{std::move(object)};
+		uint64_t seen{0};
+
+		auto subscription{moved.read.subscribe([&seen](const stupid::ref<uint64_t>& version) { seen = *version; })};
+
+		moved.write.set(uint64_t{2});
+
+		STRESS_CHECK(seen == 2);
+	}
+
+	STRESS_CHECK(late);
+
+	late.reset();
+}
+
+#if defined(__cpp_lib_coroutine)
+struct task
+{
+	struct promise_type
+	{
+		auto get_return_object() -> task { return {}; }
+		auto initial_suspend() -> std::suspend_never { return {}; }
+		auto final_suspend() noexcept -> std::suspend_never { return {}; }
+		auto return_void() -> void {}
+		auto unhandled_exception() -> void { std::terminate(); }
+	};
+};
+
+auto follow(object_t& object, uint64_t until, std::atomic<int>& finished) -> task
+{
+	for (uint64_t seen{0};;)
+	{
+		const auto version{co_await object.read.next(seen)};
+
+		STRESS_CHECK(version.generation() > seen);
+
+		seen = version.generation();
+
+		if (*version >= until) break;
+	}
+
+	finished++;
+}
+
+// Coroutines start waiting on other threads, and are resumed by the
+// writer
+auto coroutine_waiters() -> void
+{
+	constexpr int FOLLOWERS{3};
+
+	object_t object{uint64_t{0}};
+	std::atomic<int> started{0};
+	std::atomic<int> finished{0};
+
+	stress::run_threads(FOLLOWERS + 1, [&](int index)
+	{
+		if (index > 0)
+		{
+			follow(object, WRITES, finished);
+			started++;
+			return;
+		}
+
+		uint64_t i{1};
+
+		for (; i <= WRITES; i++) object.write.set(i);
+
+		// A follower which only started waiting after the last
+		// write still has to be woken before the object goes
+		while (started.load() < FOLLOWERS || finished.load() < FOLLOWERS)
+		{
+			object.write.set(i++);
+			std::this_thread::yield();
+		}
+	});
+
+	STRESS_CHECK(finished.load() == FOLLOWERS);
+}
+#endif
+
+} // namespace
+
+int main()
+{
+	static const stress::test tests[] = {
+		{"subscription_churn", subscription_churn},
+		{"reentrant_subscribers", reentrant_subscribers},
+		{"subscription_outlives_object", subscription_outlives_object},
+#if defined(__cpp_lib_coroutine)
+		{"coroutine_waiters", coroutine_waiters},
+#endif
+	};
+
+	return stress::run(tests);
+}
@@ -0,0 +1,345 @@
+#include "stress.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+
+constexpr int READERS{3};
+constexpr uint64_t WRITES{20000};
+
+// Every field holds the same number, so a reader which sees a mix of
+// two versions (or one being overwritten) can tell
+struct frame
+{
+	uint64_t values[8];
+
+	static auto make(uint64_t n) -> frame
+	{
+		frame out;
+
+		for (auto& value : out.values) value = n;
+
+		return out;
+	}
+
+	auto consistent() const -> bool
+	{
+		for (const auto value : values)
+		{
+			if (value != values[0]) return false;
+		}
+
+		return true;
+	}
+};
+
+// Readers acquire and borrow while the writer publishes as fast as it
+// can. Versions must be whole, and never go backwards.
+auto epoch_readers() -> void
+{
+	stupid::object<frame, stupid::policy::epoch<4>> object{frame::make(0)};
+	stress::stop_flag done;
+
+	stress::run_threads(READERS + 1, [&](int index)
+	{
+		if (index == 0)
+		{
+			for (uint64_t i = 1; i <= WRITES; i++) object.write.set(frame::make(i));
+
+			done.stop();
+			return;
+		}
+
+		uint64_t last{0};
+
+		while (!done.stopped())
+		{
+			const auto version{object.read.acquire()};
+
+			STRESS_CHECK(version->consistent());
+			STRESS_CHECK(version->values[0] >= last);
+			STRESS_CHECK(version.generation() == version->values[0] + 1);
+
+			last = version->values[0];
+
+			const auto borrowed{object.read.borrow()};
+
+			STRESS_CHECK(borrowed->consistent());
+			STRESS_CHECK(borrowed->values[0] >= last);
+		}
+	});
+
+	STRESS_CHECK(object.read.get_value().values[0] == WRITES);
+}
+
+// Readers copy the value out, the writer copies it in
+auto seqlock_readers() -> void
+{
+	stupid::object<frame, stupid::policy::seqlock> object{frame::make(0)};
+	stress::stop_flag done;
+
+	stress::run_threads(READERS + 1, [&](int index)
+	{
+		if (index == 0)
+		{
+			for (uint64_t i = 1; i <= WRITES; i++) object.write.set(frame::make(i));
+
+			done.stop();
+			return;
+		}
+
+		uint64_t last{0};
+
+		while (!done.stopped())
+		{
+			const auto value{object.read.get_value()};
+
+			STRESS_CHECK(value.consistent());
+			STRESS_CHECK(value.values[0] >= last);
+
+			last = value.values[0];
+		}
+	});
+}
+
+// A pool small enough to run out all the time, behind a reclaimer, with
+// readers holding on to versions for a while. Blocks which had to be
+// allocated normally must never end up in the pool.
+auto pool_and_reclaimer() -> void
+{
+	using value_t = std::vector<uint64_t>;
+
+	stupid::pool<value_t> pool{4};
+	stupid::reclaimer<value_t> reclaimer{pool};
+
+	{
+		stupid::object<value_t, stupid::policy::epoch<4>> object{reclaimer, value_t(16, 0)};
+		stress::stop_flag done;
+
+		stress::run_threads(READERS + 1, [&](int index)
+		{
+			if (index == 0)
+			{
+				for (uint64_t i = 1; i <= WRITES / 4; i++)
+				{
+					object.write.set(value_t(16, i));
+					reclaimer.collect();
+				}
+
+				done.stop();
+				return;
+			}
+
+			std::vector<stupid::ref<value_t>> held;
+
+			while (!done.stopped())
+			{
+				held.push_back(object.read.acquire());
+
+				const auto& values{*held.back()};
+
+				STRESS_CHECK(std::all_of(values.begin(), values.end(), [&](uint64_t v) { return v == values.front(); }));
+
+				if (held.size() > 3) held.erase(held.begin());
+			}
+		});
+	}
+
+	reclaimer.collect();
+}
+
+// The reclaimer used to hand normally allocated blocks to the pool
+// when the pool had been exhausted
+auto reclaimer_exhausted_pool() -> void
+{
+	stupid::pool<std::vector<int>> pool{1};
+	stupid::reclaimer<std::vector<int>> reclaimer{pool};
+
+	{
+		stupid::object<std::vector<int>> object{reclaimer, std::vector<int>(4, 0)};
+
+		const auto held{object.read.acquire()};
+
+		for (int i = 1; i <= 10; i++) object.write.set(std::vector<int>(4, i));
+
+		object.write.collect();
+		reclaimer.collect();
+
+		STRESS_CHECK(held->front() == 0);
+	}
+
+	reclaimer.collect();
+}
+
+// Blocks recycled by the writer must be marked dead while they are
+// parked, and come back to life when they are reused
+auto recycled_blocks() -> void
+{
+	stupid::object<frame, stupid::policy::epoch<4>> object{frame::make(0)};
+	stress::stop_flag done;
+
+	stress::run_threads(2, [&](int index)
+	{
+		if (index == 0)
+		{
+			for (uint64_t i = 1; i <= WRITES; i++)
+			{
+				object.write.update_inplace([i](frame& value) { value = frame::make(i); });
+			}
+
+			done.stop();
+			return;
+		}
+
+		while (!done.stopped())
+		{
+			STRESS_CHECK(object.read.acquire()->consistent());
+		}
+	});
+}
+
+// A moved object's writer carries on collecting the versions retired
+// before the move, rather than holding on to them until as many again
+// have been written
+template <typename Policy>
+auto moved_object_collects() -> void
+{
+	constexpr uint64_t HALF{5000};
+
+	stupid::object<uint64_t, Policy> object{uint64_t{0}};
+
+	for (uint64_t i = 1; i <= HALF; i++) object.write.set(i);
+
+	stupid::object<uint64_t, Policy> moved{std::move(object)};
+
+	for (uint64_t i = 1; i <= HALF; i++)
+	{
+		moved.write.set(HALF + i);
+
+		STRESS_CHECK(moved.write.stats().garbage < 8);
+	}
+
+	stupid::object<uint64_t, Policy> assigned{uint64_t{0}};
+
+	assigned.write.set(uint64_t{1});
+	assigned = std::move(moved);
+
+	for (uint64_t i = 1; i <= HALF; i++)
+	{
+		assigned.write.set(HALF * 2 + i);
+
+		STRESS_CHECK(assigned.write.stats().garbage < 8);
+	}
+
+	STRESS_CHECK(assigned.read.get_value() == HALF * 3);
+}
+
+#if defined(__cpp_exceptions)
+// A value whose constructor throws must not cost the pool a slot
+auto pool_make_throws() -> void
+{
+	struct fragile
+	{
+		explicit fragile(bool fail_)
+		{
+			if (fail_) throw std::runtime_error{"failed"};
+		}
+	};
+
+	stupid::pool<fragile> pool{2};
+
+	for (int i = 0; i < 10; i++)
+	{
+		try
+		{
+			pool.make(true);
+			STRESS_CHECK(false);
+		}
+		catch (const std::runtime_error&)
+		{
+		}
+	}
+
+	const auto a{pool.make(false)};
+	const auto b{pool.make(false)};
+
+	STRESS_CHECK(a && b);
+	STRESS_CHECK(!pool.make(false));
+
+	pool.dispose(a);
+	pool.dispose(b);
+}
+
+// The first few computations throw. Readers waiting for one of them
+// must not be left waiting, and one of them computes it instead.
+auto derived_throws() -> void
+{
+	static std::atomic<int> throws_left;
+
+	struct sum
+	{
+		auto operator()(const frame& value) const -> uint64_t
+		{
+			if (throws_left.fetch_sub(1) > 0) throw std::runtime_error{"failed"};
+
+			uint64_t out{0};
+
+			for (const auto v : value.values) out += v;
+
+			return out;
+		}
+	};
+
+	using derived_t = stupid::derived<frame, sum>;
+
+	for (uint64_t i = 1; i <= 200; i++)
+	{
+		throws_left = 3;
+
+		const stupid::object<derived_t, stupid::policy::epoch<4>> object{frame::make(i)};
+		const auto version{object.read.acquire()};
+		std::atomic<int> failures{0};
+
+		stress::run_threads(READERS, [&](int)
+		{
+			for (;;)
+			{
+				try
+				{
+					STRESS_CHECK(version->get() == i * 8);
+					break;
+				}
+				catch (const std::runtime_error&)
+				{
+					failures++;
+				}
+			}
+		});
+
+		STRESS_CHECK(failures.load() == 3);
+		STRESS_CHECK(*version->try_get() == i * 8);
+	}
+}
+#endif
+
+} // namespace
+
+int main()
+{
+	static const stress::test tests[] = {
+		{"epoch_readers", epoch_readers},
+		{"seqlock_readers", seqlock_readers},
+		{"pool_and_reclaimer", pool_and_reclaimer},
+		{"reclaimer_exhausted_pool", reclaimer_exhausted_pool},
+		{"recycled_blocks", recycled_blocks},
+		{"moved_object_collects<refcount>", moved_object_collects<stupid::policy::refcount>},
+		{"moved_object_collects<epoch>", moved_object_collects<stupid::policy::epoch<4>>},
+#if defined(__cpp_exceptions)
+		{"pool_make_throws", pool_make_throws},
+		{"derived_throws", derived_throws},
+#endif
+	};
+
+	return stress::run(tests);
+}
@@ -0,0 +1,113 @@
+#include "stress.hpp"
+
+#include <array>
+#include <string>
+
+namespace {
+
+constexpr uint64_t ITEMS{50000};
+
+// Everything arrives exactly once, in order. The strings make sure
+// AddressSanitizer sees the slots' lifetimes.
+auto spsc() -> void
+{
+	stupid::spsc_ring<std::string> ring{64};
+
+	stress::run_threads(2, [&](int index)
+	{
+		if (index == 0)
+		{
+			for (uint64_t i = 0; i < ITEMS;)
+			{
+				if (i % 3 == 0 && ring.can_push(2))
+				{
+					const std::array<std::string, 2> pair{std::to_string(i), std::to_string(i + 1)};
+
+					i += ring.push_n(pair.begin(), i + 1 < ITEMS ? 2 : 1);
+					continue;
+				}
+
+				if (ring.push(std::to_string(i))) i++;
+				else std::this_thread::yield();
+			}
+
+			return;
+		}
+
+		for (uint64_t expected = 0; expected < ITEMS;)
+		{
+			const auto popped{ring.drain([&](std::string&& value)
+			{
+				STRESS_CHECK(value == std::to_string(expected));
+				expected++;
+			})};
+
+			if (!popped) std::this_thread::yield();
+		}
+
+		STRESS_CHECK(ring.empty());
+	});
+}
+
+// Every producer's items arrive exactly once, in the order that
+// producer pushed them
+auto mpsc() -> void
+{
+	constexpr int PRODUCERS{3};
+	constexpr uint64_t PER_PRODUCER{ITEMS / PRODUCERS};
+
+	struct item
+	{
+		int producer;
+		uint64_t seq;
+	};
+
+	stupid::mpsc_ring<item> ring{64};
+
+	stress::run_threads(PRODUCERS + 1, [&](int index)
+	{
+		if (index > 0)
+		{
+			const auto producer{index - 1};
+
+			for (uint64_t i = 0; i < PER_PRODUCER;)
+			{
+				if (ring.push(item{producer, i})) i++;
+				else std::this_thread::yield();
+			}
+
+			return;
+		}
+
+		std::array<uint64_t, PRODUCERS> next{};
+
+		for (uint64_t received = 0; received < PER_PRODUCER * PRODUCERS;)
+		{
+			item value;
+
+			if (!ring.pop(value))
+			{
+				std::this_thread::yield();
+				continue;
+			}
+
+			STRESS_CHECK(value.producer >= 0 && value.producer < PRODUCERS);
+			STRESS_CHECK(value.seq == next[value.producer]);
+
+			next[value.producer]++;
+			received++;
+		}
+	});
+}
+
+} // namespace
+
+int main()
+{
+	static const stress::test tests[] = {
+		{"spsc", spsc},
+		{"mpsc", mpsc},
+	};
+
+	return stress::run(tests);
+}
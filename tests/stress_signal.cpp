@@ -0,0 +1,102 @@
+#include "stress.hpp"
+
+namespace {
+
+constexpr uint64_t WRITES{2000};
+
+// set() and update() throw the staged edits away, so there is nothing
+// left for publish() or flush() to publish
+auto staged_then_published() -> void
+{
+	stupid::sync_signal signal;
+	stupid::signal_synced_object<uint64_t> object{signal, uint64_t{0}};
+
+	object.write.stage([](uint64_t& value) { value = 1; });
+	object.write.set(uint64_t{2});
+
+	STRESS_CHECK(!object.write.has_staged());
+	STRESS_CHECK(!object.write.publish());
+	STRESS_CHECK(object.read.get_value() == 2);
+
+	object.write.stage([](uint64_t& value) { value = 3; });
+	object.write.update([](uint64_t value) { return value + 2; });
+	object.write.flush();
+
+	STRESS_CHECK(!object.write.has_staged());
+
+	signal.notify();
+
+	STRESS_CHECK(object.read.get_value() == 4);
+
+	// Staging again starts from the latest published value
+	object.write.stage([](uint64_t& value) { value++; });
+	object.write.flush();
+
+	signal.notify();
+
+	STRESS_CHECK(object.read.get_value() == 5);
+}
+
+// The reader ticks the signal and picks up whatever was published. The
+// writer mixes staged edits with immediate ones, and the reader's value
+// never goes backwards. signal_synced_object uses policy::refcount, so
+// the writer waits for each value to be picked up instead of churning.
+auto staged_and_immediate_writes() -> void
+{
+	stupid::sync_signal signal{std::memory_order_acq_rel};
+	stupid::signal_synced_object<uint64_t> object{signal, uint64_t{0}};
+	stress::stop_flag done;
+
+	stress::run_threads(2, [&](int index)
+	{
+		if (index == 0)
+		{
+			for (uint64_t i = 1; i <= WRITES; i++)
+			{
+				while (object.read.is_value_pending()) std::this_thread::yield();
+
+				switch (i % 4)
+				{
+					case 0: object.write.set(i); break;
+					case 1: object.write.update([i](uint64_t) { return i; }); break;
+					default: object.write.stage([i](uint64_t& value) { value = i; }); STRESS_CHECK(object.write.publish()); break;
+				}
+			}
+
+			object.write.flush();
+			done.stop();
+			return;
+		}
+
+		uint64_t last{0};
+
+		for (;;)
+		{
+			const auto stopped{done.stopped()};
+
+			signal.notify();
+
+			const auto value{object.read.get_value()};
+
+			STRESS_CHECK(value >= last);
+
+			last = value;
+
+			if (stopped) break;
+		}
+
+		STRESS_CHECK(last == WRITES);
+	});
+}
+
+} // namespace
+
+int main()
+{
+	static const stress::test tests[] = {
+		{"staged_then_published", staged_then_published},
+		{"staged_and_immediate_writes", staged_and_immediate_writes},
+	};
+
+	return stress::run(tests);
+}